@@ -0,0 +1,143 @@
+// Copyright 2017 UBC Sailbot
+//
+// Counts heap allocations, and times, the work the server
+// does for each SetValues request: parse the request, build
+// a subscribe reply holding a copy of the updated node, build
+// an ack, and serialize both. This is done once with messages on
+// the heap (how the server used to do it), and once with them on
+// an arena which is reset after each request (how it does now).
+// Doesn't need the network table server.
+
+#include "Reply.pb.h"
+#include "Request.pb.h"
+#include "Value.pb.h"
+
+#include <google/protobuf/arena.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+
+std::atomic_long num_allocations(0);
+
+void *operator new(size_t size) {
+    num_allocations++;
+    void *memory = malloc(size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+/*
+ * Makes a node with num_children float values underneath it,
+ * like the sensors the boat publishes.
+ */
+NetworkTable::Node MakeNode(int num_children) {
+    NetworkTable::Node node;
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::FLOAT);
+    for (int i = 0; i < num_children; i++) {
+        value.set_float_data(i);
+        *(*node.mutable_children())["value_" + std::to_string(i)].mutable_value() = value;
+    }
+    return node;
+}
+
+/*
+ * Does what the server does with one SetValues request,
+ * putting the messages on arena (the heap if it is null).
+ */
+void HandleOnce(const std::string &serialized_request, const NetworkTable::Node &node, \
+        google::protobuf::Arena *arena, std::string *output) {
+    auto *request = google::protobuf::Arena::CreateMessage<NetworkTable::Request>(arena);
+    request->ParseFromString(serialized_request);
+
+    auto *notification = google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(arena);
+    notification->set_type(NetworkTable::Reply::SUBSCRIBE);
+    auto *subscribe_reply = notification->mutable_subscribe_reply();
+    subscribe_reply->set_uri("sensors");
+    subscribe_reply->mutable_node()->CopyFrom(node);
+    for (const auto &entry : request->setvalues_request().values()) {
+        (*subscribe_reply->mutable_diffs())[entry.first] = entry.second;
+    }
+    notification->SerializeToString(output);
+
+    auto *ack = google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(arena);
+    ack->set_type(NetworkTable::Reply::ACK);
+    ack->set_id(request->id());
+    ack->SerializeToString(output);
+
+    if (arena == nullptr) {
+        delete request;
+        delete notification;
+        delete ack;
+    } else {
+        arena->Reset();
+    }
+}
+
+/*
+ * Prints the allocations and microseconds per request,
+ * for a node with num_children children.
+ */
+void Run(int num_children, int num_iterations, bool use_arena) {
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::SETVALUES);
+    request.set_id(1);
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::FLOAT);
+    value.set_float_data(1);
+    (*request.mutable_setvalues_request()->mutable_values())["sensors/value_0"] = value;
+    std::string serialized_request = request.SerializeAsString();
+
+    NetworkTable::Node node = MakeNode(num_children);
+    std::string output;
+
+    const size_t block_size = 64 * 1024;
+    std::unique_ptr<char[]> block(new char[block_size]);
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block.get();
+    options.initial_block_size = block_size;
+    google::protobuf::Arena arena(options);
+
+    // Warm up, so output has grown to its final size.
+    HandleOnce(serialized_request, node, use_arena ? &arena : nullptr, &output);
+
+    long allocations_before = num_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_iterations; i++) {
+        HandleOnce(serialized_request, node, use_arena ? &arena : nullptr, &output);
+    }
+    auto end = std::chrono::steady_clock::now();
+    long allocations = num_allocations - allocations_before;
+
+    std::cout << num_children << "\t\t" << (use_arena ? "arena" : "heap") << "\t"
+              << static_cast<double>(allocations) / num_iterations << "\t\t"
+              << std::chrono::duration<double, std::micro>(end - start).count() / num_iterations
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int num_iterations = 10000;
+    if (argc >= 2) {
+        num_iterations = std::stoi(argv[1]);
+    }
+
+    std::cout << "children\tmode\tallocs/req\tus/req" << std::endl;
+    for (int num_children : {1, 10, 100}) {
+        Run(num_children, num_iterations, false);
+        Run(num_children, num_iterations, true);
+    }
+}
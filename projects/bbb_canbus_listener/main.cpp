@@ -44,12 +44,11 @@ void SetWindSensorData(int angle, int speed, const std::string &id) {
     values.insert((std::pair<std::string, NetworkTable::Value> \
                 ("wind_sensor_"+id+"/iimwv/wind_speed", speed_nt)));
 
+    // Each frame overwrites the last, so don't wait for acks.
     try {
-        connection.SetValues(values);
+        connection.Publish(values);
     } catch (NetworkTable::NotConnectedException) {
         std::cout << "Failed to set value" << std::endl;
-    } catch (NetworkTable::TimeoutException) {
-        std::cout << "Timeout" << std::endl;
     }
 }
 
@@ -82,6 +81,18 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    // Frames arrive one value at a time, so merge them
+    // into a request every 100 ms instead of one each.
+    connection.EnableWriteBuffer(100);
+
+    // MotorCallback writes to the canbus, which can block,
+    // so don't let it hold up the connection.
+    connection.SetCallbackThreads(1);
+
+    // Keep driving the winch if the server restarts, starting
+    // from whatever angle was set while it was down.
+    connection.EnableReconnect(true);
+
     // Connect to the network table
     connection.Connect(1000, true);
 
@@ -110,19 +121,9 @@ int main(int argc, char **argv) {
         return -2;
     }
 
-    // subscribe to network-table
-    bool is_subscribed = false;
-
-    while (!is_subscribed) {
-        try {
-            connection.Subscribe("actuation_angle/winch", &MotorCallback);
-            is_subscribed = true;
-        }
-        catch (NetworkTable::NotConnectedException) {
-            std::cout << "Failed to subscribe to actuation_angle" << std::endl;
-            sleep(1);
-        }
-    }
+    // subscribe to network-table.
+    // This is sent once the server is reached.
+    connection.Subscribe("actuation_angle/winch", &MotorCallback);
 
     // Keep on reading the wind sensor data off canbus, and
     // placing the latest data in the network table.
@@ -402,11 +403,9 @@ int main(int argc, char **argv) {
                 std::cout << "z_pos " << z_pos << std::endl;
 
                 try {
-                    connection.SetValues(values);
+                    connection.Publish(values);
                 } catch (NetworkTable::NotConnectedException) {
                     std::cout << "Failed to set value" << std::endl;
-                } catch (NetworkTable::TimeoutException) {
-                    std::cout << "Timeout" << std::endl;
                 }
                 break;
             }
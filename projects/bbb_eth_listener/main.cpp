@@ -67,7 +67,11 @@ int main(int argc, char *argv[]) {
 
     NetworkTable::Connection connection;
 
+    // Actuation angles shouldn't wait behind bulk writes.
+    connection.SetPriority(NetworkTable::Request::HIGH);
 
+    // Keep forwarding the tree to the NUC if the server restarts.
+    connection.EnableReconnect(true);
     connection.Connect(1000, true);
 
     try {
@@ -82,18 +86,8 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    bool is_subscribed = false;
-
-    while (!is_subscribed) {
-        try {
-            connection.Subscribe("/", &RootCallback);
-            is_subscribed = true;
-        }
-        catch (NetworkTable::NotConnectedException) {
-            std::cout << "Failed to connect" << std::endl;
-            sleep(1);
-        }
-    }
+    // This is sent once the server is reached.
+    connection.Subscribe("/", &RootCallback);
 
     while (true) {
         /*
@@ -279,23 +279,28 @@ int main(int argc, char **argv) {
 
     receive_size = 0;
 
+    // RootCallback converts the whole tree, which is slow,
+    // so don't let it hold up the connection.
+    connection.SetCallbackThreads(1);
+
+    // Keep sending the latest tree if the server restarts.
+    connection.EnableReconnect(true);
     connection.Connect(1000, true);
 
     latest_sensors_satellite_string = "";
     latest_uccms_satellite_string = "";
 
-    bool is_subscribed = false;
-
-    while (!is_subscribed) {
-        try {
-            connection.Subscribe("/", &RootCallback);
-            is_subscribed = true;
-        }
-        catch (NetworkTable::NotConnectedException) {
-            std::cout << "Fail to connect" << std::endl;
-            sleep(1);
-        }
-    }
+    // Only ask for the nodes which end up in Sensors.proto
+    // and Uccms.proto, so that updates to anything else
+    // (ais, waypoints, ...) don't trigger the callback.
+    // This is sent once the server is reached.
+    connection.Subscribe("/", &RootCallback, {
+            "accelerometer", "boom_angle_sensor",
+            "bms_0", "bms_1", "bms_2", "bms_3", "bms_4", "bms_5",
+            "gps_0", "gps_1",
+            "rudder_motor_control_0", "rudder_motor_control_1",
+            "winch_motor_control_0", "winch_motor_control_1",
+            "wind_sensor_0", "wind_sensor_1", "wind_sensor_2"});
 
     serial.set_option(boost::asio::serial_port_base::baud_rate(19200));
     boost::asio::write(serial, boost::asio::buffer("AT\r", 3));
@@ -53,12 +53,16 @@ void RootCallback(NetworkTable::Node node, \
  * for the network table server.
  * This program will return 0 if no tests failed,
  * otherwise it will return 1.
+ * Pass --tcp <host> <port> to reach the server over TCP.
  */
-int main() {
+int main(int argc, char *argv[]) {
     int any_test_failed = 0;
     int num_queries = 5;  // How many times the set of tests is run.
 
     NetworkTable::Connection connection;
+    if (argc == 4 && std::string(argv[1]) == "--tcp") {
+        connection.EnableTcp(argv[2], std::stoi(argv[3]));
+    }
     try {
         connection.Connect(5000);
     } catch (NetworkTable::InterruptedException) {
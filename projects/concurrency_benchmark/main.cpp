@@ -0,0 +1,82 @@
+// Copyright 2017 UBC Sailbot
+//
+// Measures request throughput through a single Connection
+// shared by 1 to 8 threads, each setting and getting its own
+// value as fast as it can. Requests from different threads
+// are in flight at the same time, so throughput should grow
+// with the number of threads until the server is the bottleneck.
+// The network table server must already be running.
+
+#include "Connection.h"
+#include "Exceptions.h"
+#include "Value.pb.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs num_threads threads sharing connection for duration_millis.
+ * Prints the requests per second, and the average time
+ * each request took.
+ */
+void Run(NetworkTable::Connection *connection, int num_threads, int duration_millis) {
+    std::atomic_bool running(true);
+    std::atomic_long num_requests(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+        threads.emplace_back([connection, i, &running, &num_requests] {
+            std::string uri = "concurrency_benchmark/thread_" + std::to_string(i);
+            NetworkTable::Value value;
+            value.set_type(NetworkTable::Value::INT);
+            for (int j = 0; running; j++) {
+                try {
+                    value.set_int_data(j);
+                    connection->SetValue(uri, value);
+                    connection->GetValue(uri);
+                    num_requests += 2;
+                } catch (const NetworkTable::TimeoutException &) {
+                    // Keep going.
+                }
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_millis));
+    running = false;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << num_threads << "\t" << num_requests / seconds << "\t\t"
+              << seconds * num_threads * 1e6 / num_requests << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int duration_millis = 3000;
+    if (argc >= 2) {
+        duration_millis = std::stoi(argv[1]);
+    }
+
+    try {
+        NetworkTable::Connection connection;
+        connection.Connect(1000);
+
+        std::cout << "threads\trequests/s\tavg (us)" << std::endl;
+        for (int num_threads : {1, 2, 4, 8}) {
+            Run(&connection, num_threads, duration_millis);
+        }
+
+        connection.Disconnect();
+    } catch (const NetworkTable::TimeoutException &) {
+        std::cout << "Timed out, is the server running?" << std::endl;
+        return 1;
+    } catch (const NetworkTable::InterruptedException &) {
+        return 0;
+    }
+}
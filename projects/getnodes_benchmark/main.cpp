@@ -0,0 +1,134 @@
+// Copyright 2017 UBC Sailbot
+//
+// Measures GetNodes throughput with many clients reading
+// the whole table, while another client writes at 100 Hz.
+// Run it against a server started with --readers 0, and
+// again with reader threads, to compare.
+// The network table server must already be running.
+
+#include "Connection.h"
+#include "Exceptions.h"
+#include "Value.pb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Fills the table with num_values values, so
+ * that getting the root node is a decent amount of work.
+ */
+void Populate(int num_values) {
+    NetworkTable::Connection connection;
+    connection.Connect(1000);
+
+    std::map<std::string, NetworkTable::Value> values;
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::FLOAT);
+    for (int i = 0; i < num_values; i++) {
+        value.set_float_data(i);
+        values["getnodes_benchmark/bulk/value_" + std::to_string(i)] = value;
+    }
+    connection.SetValues(values);
+    connection.Disconnect();
+}
+
+/*
+ * Runs num_readers clients which get "/" as fast as they can,
+ * and one client which sets a value every 10 ms, for duration_millis.
+ * Prints the total reads per second, and the average and
+ * worst time the writer waited for its ack.
+ */
+void Run(int num_readers, int duration_millis) {
+    std::vector<std::unique_ptr<NetworkTable::Connection>> readers;
+    for (int i = 0; i < num_readers; i++) {
+        readers.emplace_back(new NetworkTable::Connection());
+        readers.back()->Connect(1000);
+    }
+    NetworkTable::Connection writer;
+    writer.Connect(1000);
+
+    std::atomic_bool running(true);
+    std::atomic_int num_reads(0);
+    std::vector<std::thread> reader_threads;
+    for (auto &reader : readers) {
+        NetworkTable::Connection *connection = reader.get();
+        reader_threads.emplace_back([connection, &running, &num_reads] {
+            while (running) {
+                try {
+                    connection->GetNode("/");
+                    num_reads++;
+                } catch (const NetworkTable::TimeoutException &) {
+                    // Keep going, a slow read is what we're measuring.
+                }
+            }
+        });
+    }
+
+    std::vector<double> write_micros;
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::INT);
+    auto start = std::chrono::steady_clock::now();
+    auto next_write = start;
+    auto end = start + std::chrono::milliseconds(duration_millis);
+    for (int i = 0; next_write < end; i++) {
+        std::this_thread::sleep_until(next_write);
+        next_write += std::chrono::milliseconds(10);
+
+        value.set_int_data(i);
+        auto write_start = std::chrono::steady_clock::now();
+        writer.SetValue("getnodes_benchmark/counter", value);
+        auto write_end = std::chrono::steady_clock::now();
+        write_micros.push_back(std::chrono::duration<double, std::micro>(write_end - write_start).count());
+    }
+
+    running = false;
+    for (auto &reader_thread : reader_threads) {
+        reader_thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    writer.Disconnect();
+    for (auto &reader : readers) {
+        reader->Disconnect();
+    }
+
+    double total_micros = 0;
+    for (double micros : write_micros) {
+        total_micros += micros;
+    }
+    std::cout << num_readers << "\t" << num_reads / seconds << "\t\t"
+              << total_micros / write_micros.size() << "\t\t"
+              << *std::max_element(write_micros.begin(), write_micros.end()) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int num_values = 1000;
+    int duration_millis = 3000;
+    if (argc >= 2) {
+        num_values = std::stoi(argv[1]);
+    }
+    if (argc >= 3) {
+        duration_millis = std::stoi(argv[2]);
+    }
+
+    try {
+        Populate(num_values);
+
+        std::cout << "readers\treads/s\t\tavg write (us)\tmax write (us)" << std::endl;
+        for (int num_readers : {1, 4, 16}) {
+            Run(num_readers, duration_millis);
+        }
+    } catch (const NetworkTable::TimeoutException &) {
+        std::cout << "Timed out, is the server running?" << std::endl;
+        return 1;
+    } catch (const NetworkTable::InterruptedException &) {
+        return 0;
+    }
+}
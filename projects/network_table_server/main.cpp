@@ -4,9 +4,53 @@
 #include "Exceptions.h"
 
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
-int main() {
+void PrintUsage() {
+    std::cout << "usage: ./network_table_server [--derived <derived values file>]"
+              << " [--readers <number of GetNodes threads>]"
+              << " [--tcp <address>:<port>]" << std::endl;
+    std::cout << "--tcp binds <port> and <port> + 1 (for fan-out subscribers)"
+              << " on <address>, ex. --tcp 10.0.0.8:5555" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
     NetworkTable::Server server;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage();
+            return 1;
+        }
+
+        try {
+            if (arg == "--derived") {
+                server.LoadDerivedValues(argv[++i]);
+            } else if (arg == "--readers") {
+                server.SetNumReaderThreads(std::stoi(argv[++i]));
+            } else if (arg == "--tcp") {
+                std::string endpoint = argv[++i];
+                size_t colon = endpoint.rfind(':');
+                if (colon == std::string::npos) {
+                    throw std::invalid_argument("expected <address>:<port>");
+                }
+                server.ListenOnTcp(endpoint.substr(0, colon), \
+                        std::stoi(endpoint.substr(colon + 1)));
+            } else {
+                PrintUsage();
+                return 1;
+            }
+        } catch (const std::exception &e) {
+            // Bad numbers, files which can't be loaded
+            // and ports which can't be bound all end up here.
+            std::cout << arg << ": " << e.what() << std::endl;
+            PrintUsage();
+            return 1;
+        }
+    }
+
     try {
         server.Run();
     } catch (NetworkTable::InterruptedException) {
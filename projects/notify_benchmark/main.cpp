@@ -0,0 +1,104 @@
+// Copyright 2017 UBC Sailbot
+//
+// Measures how long it takes for updates to reach
+// many subscribers of the root node, with and without
+// the server's fan-out socket.
+// The network table server must already be running.
+
+#include "Connection.h"
+#include "Exceptions.h"
+#include "Value.pb.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::atomic_int notifications_received(0);
+
+void RootCallback(NetworkTable::Node, \
+        const std::map<std::string, NetworkTable::Value> &, \
+        bool) {
+    notifications_received++;
+}
+
+/*
+ * Connects num_subscribers clients which subscribe to "/",
+ * then sets a value num_updates times and waits until
+ * every subscriber got every update.
+ * Returns how long that took in milliseconds,
+ * or -1 if some updates never arrived.
+ */
+double Run(int num_subscribers, int num_updates, bool use_fanout) {
+    std::vector<std::unique_ptr<NetworkTable::Connection>> subscribers;
+    for (int i = 0; i < num_subscribers; i++) {
+        subscribers.emplace_back(new NetworkTable::Connection());
+        if (use_fanout) {
+            subscribers.back()->EnableFanout();
+        }
+        subscribers.back()->Connect(1000);
+        subscribers.back()->Subscribe("/", &RootCallback);
+    }
+
+    NetworkTable::Connection writer;
+    writer.Connect(1000);
+
+    notifications_received = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::INT);
+    for (int i = 0; i < num_updates; i++) {
+        value.set_int_data(i);
+        writer.SetValue("notify_benchmark/value", value);
+    }
+
+    int expected = num_subscribers * num_updates;
+    auto deadline = start + std::chrono::seconds(30);
+    while (notifications_received < expected && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    bool all_received = notifications_received >= expected;
+    writer.Disconnect();
+    for (auto &subscriber : subscribers) {
+        subscriber->Disconnect();
+    }
+
+    if (!all_received) {
+        return -1;
+    }
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    int num_updates = 200;
+    if (argc == 2) {
+        num_updates = std::stoi(argv[1]);
+    }
+
+    std::cout << "subscribers\tmode\ttotal (ms)\tper update (us)" << std::endl;
+    try {
+        for (int num_subscribers : {1, 10, 50}) {
+            for (bool use_fanout : {false, true}) {
+                double millis = Run(num_subscribers, num_updates, use_fanout);
+                std::cout << num_subscribers << "\t\t" << (use_fanout ? "fanout" : "pair") << "\t";
+                if (millis < 0) {
+                    std::cout << "updates lost" << std::endl;
+                } else {
+                    std::cout << millis << "\t\t" << millis * 1000 / num_updates << std::endl;
+                }
+            }
+        }
+    } catch (const NetworkTable::TimeoutException &) {
+        std::cout << "Timed out, is the server running?" << std::endl;
+        return 1;
+    } catch (const NetworkTable::InterruptedException &) {
+        return 0;
+    }
+}
@@ -0,0 +1,125 @@
+// Copyright 2017 UBC Sailbot
+//
+// Measures how long actuation writes take while other
+// clients flood the server with bulk writes, with the
+// actuation writes at normal and at high priority.
+// The network table server must already be running.
+
+#include "Connection.h"
+#include "Exceptions.h"
+#include "Value.pb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Makes a write like the list of nearby boats from AIS:
+ * num_values values in a single request.
+ */
+std::map<std::string, NetworkTable::Value> MakeBulkValues(int writer, int num_values) {
+    std::map<std::string, NetworkTable::Value> values;
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::FLOAT);
+    for (int i = 0; i < num_values; i++) {
+        value.set_float_data(i);
+        values["priority_benchmark/ais_" + std::to_string(writer) + "/boat_" + std::to_string(i)] = value;
+    }
+    return values;
+}
+
+/*
+ * Runs num_bulk_writers clients which write as fast as they can,
+ * and one client which writes an actuation angle every 10 ms
+ * at priority, for duration_millis.
+ * Prints the average, 99th percentile and worst actuation write time.
+ */
+void Run(int num_bulk_writers, NetworkTable::Request::Priority priority, int duration_millis) {
+    std::vector<std::unique_ptr<NetworkTable::Connection>> bulk_writers;
+    for (int i = 0; i < num_bulk_writers; i++) {
+        bulk_writers.emplace_back(new NetworkTable::Connection());
+        bulk_writers.back()->Connect(1000);
+    }
+    NetworkTable::Connection actuation;
+    actuation.SetPriority(priority);
+    actuation.Connect(1000);
+
+    std::atomic_bool running(true);
+    std::vector<std::thread> bulk_threads;
+    for (int i = 0; i < num_bulk_writers; i++) {
+        NetworkTable::Connection *connection = bulk_writers[i].get();
+        bulk_threads.emplace_back([connection, i, &running] {
+            auto values = MakeBulkValues(i, 500);
+            while (running) {
+                try {
+                    connection->SetValues(values);
+                } catch (const NetworkTable::TimeoutException &) {
+                    // Keep flooding.
+                }
+            }
+        });
+    }
+
+    std::vector<double> write_micros;
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::FLOAT);
+    auto start = std::chrono::steady_clock::now();
+    auto next_write = start;
+    auto end = start + std::chrono::milliseconds(duration_millis);
+    for (int i = 0; next_write < end; i++) {
+        std::this_thread::sleep_until(next_write);
+        next_write += std::chrono::milliseconds(10);
+
+        value.set_float_data(i % 90);
+        auto write_start = std::chrono::steady_clock::now();
+        actuation.SetValue("actuation_angle/winch", value);
+        auto write_end = std::chrono::steady_clock::now();
+        write_micros.push_back(std::chrono::duration<double, std::micro>(write_end - write_start).count());
+    }
+
+    running = false;
+    for (auto &bulk_thread : bulk_threads) {
+        bulk_thread.join();
+    }
+    actuation.Disconnect();
+    for (auto &bulk_writer : bulk_writers) {
+        bulk_writer->Disconnect();
+    }
+
+    std::sort(write_micros.begin(), write_micros.end());
+    double total_micros = 0;
+    for (double micros : write_micros) {
+        total_micros += micros;
+    }
+    std::cout << num_bulk_writers << "\t"
+              << (priority == NetworkTable::Request::HIGH ? "high" : "normal") << "\t\t"
+              << total_micros / write_micros.size() << "\t\t"
+              << write_micros[write_micros.size() * 99 / 100] << "\t\t"
+              << write_micros.back() << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int duration_millis = 3000;
+    if (argc >= 2) {
+        duration_millis = std::stoi(argv[1]);
+    }
+
+    try {
+        std::cout << "bulk\tpriority\tavg (us)\tp99 (us)\tmax (us)" << std::endl;
+        for (int num_bulk_writers : {0, 4, 16}) {
+            Run(num_bulk_writers, NetworkTable::Request::NORMAL, duration_millis);
+            Run(num_bulk_writers, NetworkTable::Request::HIGH, duration_millis);
+        }
+    } catch (const NetworkTable::TimeoutException &) {
+        std::cout << "Timed out, is the server running?" << std::endl;
+        return 1;
+    } catch (const NetworkTable::InterruptedException &) {
+        return 0;
+    }
+}
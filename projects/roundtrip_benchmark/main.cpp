@@ -0,0 +1,77 @@
+// Copyright 2017 UBC Sailbot
+//
+// Measures how long a client waits for SetValue and GetValue,
+// one request at a time. Nothing else should be using the
+// server, so that this is mostly the time spent in the client
+// library and the hop between it and the server.
+// The network table server must already be running.
+
+#include "Connection.h"
+#include "Exceptions.h"
+#include "Value.pb.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Calls request num_iterations times, and prints the
+ * average, median and 99th percentile time it took.
+ */
+void Run(const std::string &name, int num_iterations, std::function<void(int)> request) {
+    // Warm up, so connecting and the first
+    // allocations aren't counted.
+    for (int i = 0; i < 100; i++) {
+        request(i);
+    }
+
+    std::vector<double> micros;
+    for (int i = 0; i < num_iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        request(i);
+        auto end = std::chrono::steady_clock::now();
+        micros.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+
+    std::sort(micros.begin(), micros.end());
+    double total_micros = 0;
+    for (double request_micros : micros) {
+        total_micros += request_micros;
+    }
+    std::cout << name << "\t" << total_micros / micros.size() << "\t\t"
+              << micros[micros.size() / 2] << "\t\t"
+              << micros[micros.size() * 99 / 100] << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int num_iterations = 10000;
+    if (argc >= 2) {
+        num_iterations = std::stoi(argv[1]);
+    }
+
+    try {
+        NetworkTable::Connection connection;
+        connection.Connect(1000);
+
+        NetworkTable::Value value;
+        value.set_type(NetworkTable::Value::INT);
+        std::cout << "request\t\tavg (us)\tp50 (us)\tp99 (us)" << std::endl;
+        Run("SetValue", num_iterations, [&connection, &value](int i) {
+            value.set_int_data(i);
+            connection.SetValue("roundtrip_benchmark/value", value);
+        });
+        Run("GetValue", num_iterations, [&connection](int) {
+            connection.GetValue("roundtrip_benchmark/value");
+        });
+
+        connection.Disconnect();
+    } catch (const NetworkTable::TimeoutException &) {
+        std::cout << "Timed out, is the server running?" << std::endl;
+        return 1;
+    } catch (const NetworkTable::InterruptedException &) {
+        return 0;
+    }
+}
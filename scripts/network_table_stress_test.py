@@ -22,11 +22,27 @@ from generated_python import Value_pb2
 
 continue_server = True
 error_occured = False
+tcp_port = None
+
+
+def server_command():
+    """The command to start the network table server with"""
+    if tcp_port:
+        return ['./bin/network_table_server', '--tcp',
+                '127.0.0.1:' + str(tcp_port)]
+    return ['./bin/network_table_server']
+
+
+def client_command():
+    """The command to start a C++ client with"""
+    if tcp_port:
+        return ['./bin/client', '--tcp', '127.0.0.1', str(tcp_port)]
+    return ['./bin/client']
 
 
 def run_server():
     """Runs the network table server"""
-    server = subprocess.Popen(['./bin/network_table_server'],
+    server = subprocess.Popen(server_command(),
                               preexec_fn=os.setsid)
     while continue_server:
         sleep(5)
@@ -39,7 +55,7 @@ def run_server_and_fake_crashes():
     """Runs the network table server, but closes the server and restarts it every few seconds.
     This is to simulate the server crashing and restarting."""
     while continue_server:
-        server = subprocess.Popen(['./bin/network_table_server'],
+        server = subprocess.Popen(server_command(),
                                   preexec_fn=os.setsid)
         for i in range(1, 5):
             if not continue_server:
@@ -126,6 +142,11 @@ if __name__ == '__main__':
                 instead of the C++ client",
         action='store_true')
 
+    parser.add_argument(
+        "--tcp", help="Connect the C++ clients to the server over\
+                TCP on this loopback port, instead of ipc",
+        type=int)
+
     # note that this is only needed by python. The C++ code
     # automatically does this with a define statement set by cmake.
     parser.add_argument(
@@ -140,6 +161,7 @@ if __name__ == '__main__':
     python_client = args.python_client
     python_client_welcome_dir = args.python_client_welcome_dir
     build = args.compile  # variable name compile is not allowed
+    tcp_port = args.tcp
 
     # Go to the build directory
     script_location = os.path.dirname(os.path.realpath(__file__))
@@ -177,7 +199,7 @@ if __name__ == '__main__':
         # This is an array of client processes which will communicate with the server.
         # They will all run at the same time, then the return value of each
         # one will be checked.
-        clients = [subprocess.Popen(['./bin/client'],
+        clients = [subprocess.Popen(client_command(),
                                     preexec_fn=os.setsid)
                    for i in range(num_clients)]
 
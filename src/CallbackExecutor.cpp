@@ -0,0 +1,91 @@
+// Copyright 2017 UBC Sailbot
+
+#include "CallbackExecutor.h"
+
+NetworkTable::CallbackExecutor::CallbackExecutor() : queue_depth_(0), max_queue_depth_(0) {
+}
+
+NetworkTable::CallbackExecutor::~CallbackExecutor() {
+    Stop();
+}
+
+void NetworkTable::CallbackExecutor::Start(int num_threads) {
+    Stop();
+    queue_depth_ = 0;
+    max_queue_depth_ = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        workers_.emplace_back(new Worker());
+        Worker *worker = workers_.back().get();
+        worker->running = true;
+        worker->thread = std::thread(&NetworkTable::CallbackExecutor::RunWorker, this, worker);
+    }
+}
+
+void NetworkTable::CallbackExecutor::Stop() {
+    for (auto &worker : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->running = false;
+            queue_depth_ -= worker->callbacks.size();
+            worker->callbacks.clear();
+        }
+        worker->has_callbacks.notify_one();
+        worker->thread.join();
+    }
+    workers_.clear();
+}
+
+void NetworkTable::CallbackExecutor::Run(const std::string &key, std::function<void()> callback) {
+    if (workers_.empty()) {
+        callback();
+        return;
+    }
+
+    Worker *worker = workers_[std::hash<std::string>()(key) % workers_.size()].get();
+    size_t queue_depth;
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (!worker->running) {
+            return;
+        }
+        // Count it before the worker can take it, so
+        // the depth never goes below zero.
+        queue_depth = ++queue_depth_;
+        worker->callbacks.push_back(std::move(callback));
+    }
+    worker->has_callbacks.notify_one();
+
+    size_t max_queue_depth = max_queue_depth_;
+    while (queue_depth > max_queue_depth \
+            && !max_queue_depth_.compare_exchange_weak(max_queue_depth, queue_depth)) {
+    }
+}
+
+size_t NetworkTable::CallbackExecutor::QueueDepth() const {
+    return queue_depth_;
+}
+
+size_t NetworkTable::CallbackExecutor::MaxQueueDepth() const {
+    return max_queue_depth_;
+}
+
+void NetworkTable::CallbackExecutor::RunWorker(Worker *worker) {
+    while (true) {
+        std::function<void()> callback;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->has_callbacks.wait(lock, [worker] {
+                return !worker->running || !worker->callbacks.empty();
+            });
+            if (!worker->running) {
+                return;
+            }
+            callback = std::move(worker->callbacks.front());
+            worker->callbacks.pop_front();
+        }
+        queue_depth_--;
+
+        callback();
+    }
+}
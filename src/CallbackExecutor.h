@@ -0,0 +1,79 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef CALLBACKEXECUTOR_H_
+#define CALLBACKEXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace NetworkTable {
+/*
+ * Runs subscription callbacks, so that a slow one doesn't
+ * hold up the thread which receives replies.
+ *
+ * With no threads, callbacks run inline on the thread which
+ * calls Run. Otherwise each key (eg. a uri) is assigned to one
+ * of the threads, so callbacks for the same key run one at a time
+ * and in the order they were added, while callbacks for
+ * different keys can run at the same time.
+ */
+class CallbackExecutor {
+ public:
+    CallbackExecutor();
+    ~CallbackExecutor();
+
+    /*
+     * Starts num_threads threads to run callbacks on.
+     * 0 runs them inline.
+     */
+    void Start(int num_threads);
+
+    /*
+     * Joins the threads. Callbacks which haven't
+     * started running yet are dropped.
+     */
+    void Stop();
+
+    /*
+     * Runs callback now, or queues it on the thread for key.
+     * Safe to call from any thread, but not at the
+     * same time as Start or Stop.
+     */
+    void Run(const std::string &key, std::function<void()> callback);
+
+    /*
+     * Number of callbacks waiting to run,
+     * and the most there has been since Start.
+     */
+    size_t QueueDepth() const;
+    size_t MaxQueueDepth() const;
+
+ private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable has_callbacks;
+        std::deque<std::function<void()>> callbacks;
+        bool running;
+        std::thread thread;
+    };
+
+    /*
+     * Runs in each worker's thread until Stop.
+     */
+    void RunWorker(Worker *worker);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> queue_depth_;
+    std::atomic<size_t> max_queue_depth_;
+};
+}  // namespace NetworkTable
+
+#endif  // CALLBACKEXECUTOR_H_
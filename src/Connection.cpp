@@ -3,32 +3,126 @@
 #include "Connection.h"
 
 #include <assert.h>
+#include <algorithm>
 #include <chrono>
 #include <stdio.h>
 #include <string.h>
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/uuid/uuid_io.hpp>
+#include <google/protobuf/arena.h>
 #include <zmq.hpp>
 #include <csignal>
 #include <cerrno>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
 #include "Exceptions.h"
 #include "GetNodesRequest.pb.h"
 #include "SetValuesRequest.pb.h"
 #include "ErrorReply.pb.h"
+#include "Help.h"
+#include "ModifyValueReply.pb.h"
 
 // Use this to check if we received
 // a signal, ex SIGINT
 static volatile sig_atomic_t signaled = 0;
 static volatile std::atomic<bool> signal_handler_registered(false);
 
-void signal_handler(int param) {
+static void signal_handler(int param) {
       signaled = 1;
 }
 
-NetworkTable::Connection::Connection() : context_(1),
+// Helper function
+// Returns true if message is the null terminated string text,
+// without copying the message into a std::string first.
+static bool MessageIs(const zmq::message_t &message, const char *text) {
+    size_t text_size = strlen(text) + 1;
+    return message.size() == text_size && memcmp(message.data(), text, text_size) == 0;
+}
+
+// Helper function
+// Fills in a SetValuesRequest with each of the uri/value pairs.
+static void MakeSetValuesRequest(const std::map<std::string, NetworkTable::Value> &values, \
+        NetworkTable::Request *request) {
+    request->set_type(NetworkTable::Request::SETVALUES);
+    auto *mutable_values = request->mutable_setvalues_request()->mutable_values();
+    for (auto const &entry : values) {
+        (*mutable_values)[entry.first] = entry.second;
+    }
+}
+
+// Helper function
+// Options for an arena which starts out using block,
+// instead of allocating its first block itself.
+static google::protobuf::ArenaOptions ArenaOptionsWithBlock(char *block, size_t block_size) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = block_size;
+    return options;
+}
+
+// Passed by reference to setsockopt and std::chrono,
+// so these need a definition.
+const int NetworkTable::Connection::kHeartbeatIntervalMillis_;
+const int NetworkTable::Connection::kHeartbeatTimeoutMillis_;
+const int NetworkTable::Connection::kMinReconnectMillis_;
+const int NetworkTable::Connection::kMaxReconnectMillis_;
+const int NetworkTable::Connection::kDisconnectLingerMillis_;
+
+// Helper function
+// Prints one line of PrintStats.
+static void PrintLatency(const std::string &name, const NetworkTable::LatencyStats &stats) {
+    std::cout << "  " << name << ": " << stats.count << " in total, mean " \
+              << stats.mean_micros << " us, p50 " << stats.PercentileMicros(0.5) << " us, p99 " \
+              << stats.PercentileMicros(0.99) << " us, max " << stats.max_micros << " us" << std::endl;
+}
+
+// Helper function
+// Prints what Connection::GetStats returned, for the stats dump.
+static void PrintStats(const NetworkTable::ConnectionStats &stats) {
+    std::cout << "Connection stats:" << std::endl;
+    PrintLatency("connect", stats.connect);
+    PrintLatency("set", stats.set);
+    PrintLatency("get", stats.get);
+    PrintLatency("subscribe", stats.subscribe);
+    PrintLatency("callback dispatch", stats.callback_dispatch);
+    PrintLatency("callback run", stats.callback_run);
+    PrintLatency("queue wait", stats.queue_wait);
+    std::cout << "  timeouts: " << stats.timeouts \
+              << ", stale replies: " << stats.stale_replies \
+              << ", bytes sent: " << stats.bytes_sent \
+              << ", bytes received: " << stats.bytes_received \
+              << ", callback queue: " << stats.callback_queue_depth \
+              << " (max " << stats.max_callback_queue_depth << ")" << std::endl;
+}
+
+NetworkTable::Connection::Connection(const std::string &directory, \
+                                     const std::string &shared_memory_name) : context_(1),
                                          mst_socket_(context_, ZMQ_PAIR),
-                                         connected_(false) {
+                                         connected_(false),
+                                         timeout_millis_(-1),
+                                         next_request_id_(1),
+                                         use_fanout_(false),
+                                         use_shared_memory_(false),
+                                         use_router_(false),
+                                         connection_id_(0),
+                                         reconnect_(false),
+                                         refetch_on_reconnect_(false),
+                                         tcp_port_(0),
+                                         priority_(NetworkTable::Request::NORMAL),
+                                         publish_sequence_number_(0),
+                                         write_buffer_interval_millis_(0),
+                                         write_buffer_max_values_(0),
+                                         reading_shared_memory_(false),
+                                         last_shared_memory_message_(0),
+                                         callback_threads_(0),
+                                         timeouts_(0),
+                                         stale_replies_(0),
+                                         bytes_sent_(0),
+                                         bytes_received_(0),
+                                         stats_dump_interval_millis_(0),
+                                         kWelcome_Directory_(directory),
+                                         kSharedMemoryName_(shared_memory_name) {
     // Register our signal handler.
     // After this, if we ctrl-c,
     // this function will be called, which allows
@@ -39,9 +133,110 @@ NetworkTable::Connection::Connection() : context_(1),
     }
 }
 
+void NetworkTable::Connection::EnableFanout() {
+    assert(!connected_);
+    use_fanout_ = true;
+}
+
+void NetworkTable::Connection::EnableSharedMemory() {
+    assert(!connected_);
+    use_shared_memory_ = true;
+}
+
+void NetworkTable::Connection::EnableRouter() {
+    assert(!connected_);
+    use_router_ = true;
+}
+
+void NetworkTable::Connection::EnableTcp(const std::string &host, int port) {
+    assert(!connected_);
+    use_router_ = true;
+    tcp_host_ = host;
+    tcp_port_ = port;
+}
+
+void NetworkTable::Connection::EnableReconnect(bool refetch) {
+    assert(!connected_);
+    reconnect_ = true;
+    refetch_on_reconnect_ = refetch;
+}
+
+void NetworkTable::Connection::SetPriority(NetworkTable::Request::Priority priority) {
+    priority_ = priority;
+}
+
+void NetworkTable::Connection::SetCallbackThreads(int num_threads) {
+    assert(!connected_);
+    callback_threads_ = std::max(num_threads, 0);
+}
+
+size_t NetworkTable::Connection::CallbackQueueDepth() const {
+    return callback_executor_.QueueDepth();
+}
+
+size_t NetworkTable::Connection::MaxCallbackQueueDepth() const {
+    return callback_executor_.MaxQueueDepth();
+}
+
+NetworkTable::ConnectionStats NetworkTable::Connection::GetStats() const {
+    NetworkTable::ConnectionStats stats;
+    stats.connect = connect_latency_.Read();
+    stats.set = set_latency_.Read();
+    stats.get = get_latency_.Read();
+    stats.subscribe = subscribe_latency_.Read();
+    stats.callback_dispatch = callback_dispatch_latency_.Read();
+    stats.callback_run = callback_run_latency_.Read();
+    stats.queue_wait = queue_wait_latency_.Read();
+    stats.timeouts = timeouts_;
+    stats.stale_replies = stale_replies_;
+    stats.bytes_sent = bytes_sent_;
+    stats.bytes_received = bytes_received_;
+    stats.callback_queue_depth = callback_executor_.QueueDepth();
+    stats.max_callback_queue_depth = callback_executor_.MaxQueueDepth();
+    return stats;
+}
+
+void NetworkTable::Connection::EnableStatsDump(int interval_millis) {
+    assert(!connected_);
+    stats_dump_interval_millis_ = std::max(interval_millis, 1);
+}
+
+void NetworkTable::Connection::EnableWriteBuffer(int flush_interval_millis, size_t max_values) {
+    assert(!connected_);
+    write_buffer_interval_millis_ = std::max(flush_interval_millis, 1);
+    write_buffer_max_values_ = std::max(max_values, static_cast<size_t>(1));
+}
+
+void NetworkTable::Connection::Flush() {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to flush"));
+    }
+
+    auto flushed = std::make_shared<std::promise<NetworkTable::Reply>>();
+    auto future_reply = flushed->get_future();
+    {
+        std::lock_guard<std::mutex> lock(write_buffer_mutex_);
+        flush_waiters_.push_back(flushed);
+    }
+    RequestFlush();
+
+    // The flush has no id of its own until
+    // the manage socket thread sends it.
+    WaitForReply(0, &future_reply);
+}
+
 void NetworkTable::Connection::Connect(int timeout_millis, bool async) {
     assert(!connected_);
 
+    for (auto *latency : {&connect_latency_, &set_latency_, &get_latency_, &subscribe_latency_, \
+            &callback_dispatch_latency_, &callback_run_latency_, &queue_wait_latency_}) {
+        latency->Reset();
+    }
+    timeouts_ = 0;
+    stale_replies_ = 0;
+    bytes_sent_ = 0;
+    bytes_received_ = 0;
+
     mst_socket_.bind("inproc://#1");
     socket_thread_ = std::thread(&NetworkTable::Connection::ManageSocket, this, timeout_millis, async);
 
@@ -56,8 +251,8 @@ void NetworkTable::Connection::Connect(int timeout_millis, bool async) {
             }
         }
 
-        std::string message_data(static_cast<char*>(message.data()), message.size());
-        if (strcmp(message_data.c_str(), "timeout") == 0) {
+        if (MessageIs(message, "timeout")) {
+            timeouts_++;
             socket_thread_.join();
             throw TimeoutException(const_cast<char*>("timed out when connecting to server"));
         }
@@ -67,10 +262,14 @@ void NetworkTable::Connection::Connect(int timeout_millis, bool async) {
 
     mst_socket_.setsockopt(ZMQ_RCVTIMEO, timeout_millis);
     mst_socket_.setsockopt(ZMQ_SNDTIMEO, timeout_millis);
+    timeout_millis_ = timeout_millis;
 }
 
 void NetworkTable::Connection::Disconnect() {
-    if (!connected_) {
+    // Held until the manage socket thread is gone,
+    // so that only one thread can disconnect.
+    std::lock_guard<std::recursive_mutex> lock(mst_socket_mutex_);
+    if (!connected_ || !socket_thread_.joinable()) {
         throw NotConnectedException(const_cast<char*>("fail to disconnect"));
     }
 
@@ -90,6 +289,11 @@ void NetworkTable::Connection::Disconnect() {
     }
 
     socket_thread_.join();
+
+    // The server forgets our subscriptions, so
+    // the cache would stop being updated.
+    std::lock_guard<std::mutex> cache_lock(cache_mutex_);
+    cache_.clear();
 }
 
 ////////////////////// PUBLIC //////////////////////
@@ -107,30 +311,106 @@ void NetworkTable::Connection::SetValues(const std::map<std::string, NetworkTabl
         throw NotConnectedException(const_cast<char*>("fail to set value"));
     }
 
+    if (write_buffer_interval_millis_ > 0) {
+        BufferValues(values);
+        return;
+    }
+
     NetworkTable::Request request;
-    request.set_type(NetworkTable::Request::SETVALUES);
+    MakeSetValuesRequest(values, &request);
 
-    // Create a SetValuesRequest with each of the uri/value pairs.
-    auto *setvalues_request = request.mutable_setvalues_request();
-    auto mutable_values = setvalues_request->mutable_values();
-    for (auto const &entry : values) {
-        std::string uri = entry.first;
-        NetworkTable::Value value = entry.second;
-        (*mutable_values)[uri] = value;
+    auto reply = SendRequest(&request);
+    WaitForAck(request.id(), &reply);
+}
+
+std::future<void> NetworkTable::Connection::SetValuesAsync(\
+        const std::map<std::string, NetworkTable::Value> &values) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to set value"));
     }
 
-    try {
-        if (!Send(request, &mst_socket_)) {
-            throw TimeoutException(const_cast<char*>("set values timed out"));
-        }
+    NetworkTable::Request request;
+    MakeSetValuesRequest(values, &request);
+    return SendRequestForAck(&request);
+}
 
-        WaitForAck();
-    } catch (const zmq::error_t &e) {
-        if (signaled && e.num() == EINTR) {
-            InterruptManageSocketThread();
-            throw NetworkTable::InterruptedException("Received interrupt signal");
-        }
+std::future<void> NetworkTable::Connection::SetValueAsync(const std::string &uri, \
+        const NetworkTable::Value &value) {
+    return SetValuesAsync({{uri, value}});
+}
+
+void NetworkTable::Connection::SetValuesAsync(const std::map<std::string, NetworkTable::Value> &values, \
+        std::function<void(std::exception_ptr error)> on_done) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to set value"));
+    }
+
+    NetworkTable::Request request;
+    MakeSetValuesRequest(values, &request);
+    SendRequestAsync(&request, [on_done](std::exception_ptr error, const NetworkTable::Reply *) {
+        on_done(error);
+    });
+}
+
+bool NetworkTable::Connection::Publish(const std::string &uri, const NetworkTable::Value &value) {
+    return Publish({{uri, value}});
+}
+
+bool NetworkTable::Connection::Publish(const std::map<std::string, NetworkTable::Value> &values) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to publish"));
+    }
+
+    // Nobody waits for a reply, so this
+    // doesn't need an id or a pending request.
+    NetworkTable::Request request;
+    MakeSetValuesRequest(values, &request);
+    request.set_priority(priority_);
+    request.set_no_ack(true);
+    request.set_sequence_number(++publish_sequence_number_);
+
+    if (request_queue_.Size() >= kMaxQueuedRequests_) {
+        return false;
     }
+    QueueRequest(request);
+    return true;
+}
+
+bool NetworkTable::Connection::CompareAndSet(const std::string &uri, const NetworkTable::Value &expected, \
+        const NetworkTable::Value &value) {
+    NetworkTable::ModifyValueRequest request;
+    request.set_operation(NetworkTable::ModifyValueRequest::COMPARE_AND_SET);
+    request.set_uri(uri);
+    *request.mutable_expected() = expected;
+    *request.mutable_value() = value;
+    return ModifyValue(request).succeeded();
+}
+
+bool NetworkTable::Connection::SetIfMissing(const std::string &uri, const NetworkTable::Value &value) {
+    // Leaving expected unset means there shouldn't be a value.
+    NetworkTable::ModifyValueRequest request;
+    request.set_operation(NetworkTable::ModifyValueRequest::COMPARE_AND_SET);
+    request.set_uri(uri);
+    *request.mutable_value() = value;
+    return ModifyValue(request).succeeded();
+}
+
+NetworkTable::Value NetworkTable::Connection::Increment(const std::string &uri, \
+        const NetworkTable::Value &amount) {
+    NetworkTable::ModifyValueRequest request;
+    request.set_operation(NetworkTable::ModifyValueRequest::INCREMENT);
+    request.set_uri(uri);
+    *request.mutable_value() = amount;
+    return ModifyValue(request).value();
+}
+
+NetworkTable::Value NetworkTable::Connection::Append(const std::string &uri, \
+        const NetworkTable::Value &items) {
+    NetworkTable::ModifyValueRequest request;
+    request.set_operation(NetworkTable::ModifyValueRequest::APPEND);
+    request.set_uri(uri);
+    *request.mutable_value() = items;
+    return ModifyValue(request).value();
 }
 
 NetworkTable::Value NetworkTable::Connection::GetValue(const std::string &uri) {
@@ -149,9 +429,26 @@ std::map<std::string, NetworkTable::Value> NetworkTable::Connection::GetValues(c
     }
 
     std::map<std::string, NetworkTable::Value> values;
+    std::set<std::string> uncached_uris = uris;
+    GetCachedValues(&uncached_uris, &values);
+    if (uncached_uris.empty()) {
+        return values;
+    }
+
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::GETNODES);
+
+    auto *getnodes_request = request.mutable_getnodes_request();
+    for (auto const &uri : uncached_uris) {
+        getnodes_request->add_uris(uri);
+    }
 
-    for (auto const &uriNodePair : GetNodes(uris)) {
-        values[uriNodePair.first] = uriNodePair.second.value();
+    auto future_reply = SendRequest(&request);
+    NetworkTable::Reply reply = WaitForReply(request.id(), &future_reply);
+
+    // Only copy the values out, not the whole nodes.
+    for (auto const &entry : reply.getnodes_reply().nodes()) {
+        values[entry.first] = entry.second.value();
     }
 
     return values;
@@ -172,54 +469,77 @@ std::map<std::string, NetworkTable::Node> NetworkTable::Connection::GetNodes(con
         throw NotConnectedException(const_cast<char*>("fail to get node"));
     }
 
+    std::map<std::string, NetworkTable::Node> nodes;
+    std::set<std::string> uncached_uris = uris;
+    GetCachedNodes(&uncached_uris, &nodes);
+    if (uncached_uris.empty()) {
+        return nodes;
+    }
+
     NetworkTable::Request request;
     request.set_type(NetworkTable::Request::GETNODES);
 
     auto *getnodes_request = request.mutable_getnodes_request();
 
-    for (auto const &uri : uris) {
+    for (auto const &uri : uncached_uris) {
         getnodes_request->add_uris(uri);
     }
 
-    try {
-        if (!Send(request, &mst_socket_)) {
-            throw TimeoutException(const_cast<char*>("getnodes send timed out"));
-        }
-    } catch (const zmq::error_t &e) {
-        if (signaled && e.num() == EINTR) {
-            InterruptManageSocketThread();
-            throw NetworkTable::InterruptedException("Received interrupt signal");
-        }
+    auto future_reply = SendRequest(&request);
+    NetworkTable::Reply reply = WaitForReply(request.id(), &future_reply);
+
+    for (auto const &entry : reply.getnodes_reply().nodes()) {
+        nodes[entry.first] = entry.second;
     }
 
-    NetworkTable::Reply reply;
-    try {
-        if (!Receive(&reply, &mst_socket_)) {
-            throw TimeoutException(const_cast<char*>("getnodes reply timed out"));
-        }
-    } catch (const zmq::error_t &e) {
-        if (signaled && e.num() == EINTR) {
-            InterruptManageSocketThread();
-            throw NetworkTable::InterruptedException("Received interrupt signal");
+    return nodes;
+}
+
+std::future<std::map<std::string, NetworkTable::Node>> NetworkTable::Connection::GetNodesAsync(\
+        const std::set<std::string> &uris) {
+    auto got_nodes = std::make_shared<std::promise<std::map<std::string, NetworkTable::Node>>>();
+    GetNodesAsync(uris, [got_nodes](std::exception_ptr error, \
+                const std::map<std::string, NetworkTable::Node> &nodes) {
+        if (error) {
+            got_nodes->set_exception(error);
+        } else {
+            got_nodes->set_value(nodes);
         }
+    });
+    return got_nodes->get_future();
+}
+
+void NetworkTable::Connection::GetNodesAsync(const std::set<std::string> &uris, \
+        std::function<void(std::exception_ptr error, \
+            const std::map<std::string, NetworkTable::Node> &nodes)> on_done) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to get node"));
     }
 
-    CheckForError(reply);
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::GETNODES);
 
-    std::map<std::string, NetworkTable::Node> nodes;
-    for (auto const &entry : reply.getnodes_reply().nodes()) {
-        std::string uri = entry.first;
-        NetworkTable::Node node = entry.second;
-        nodes[uri] = node;
+    auto *getnodes_request = request.mutable_getnodes_request();
+    for (auto const &uri : uris) {
+        getnodes_request->add_uris(uri);
     }
 
-    return nodes;
+    SendRequestAsync(&request, [on_done](std::exception_ptr error, const NetworkTable::Reply *reply) {
+        std::map<std::string, NetworkTable::Node> nodes;
+        if (!error) {
+            for (auto const &entry : reply->getnodes_reply().nodes()) {
+                nodes[entry.first] = entry.second;
+            }
+        }
+        on_done(error, nodes);
+    });
 }
 
-void NetworkTable::Connection::Subscribe(std::string uri, \
-        void (*callback)(NetworkTable::Node node, \
-            const std::map<std::string, NetworkTable::Value> &diffs, \
-            bool is_self_reply)) {
+void NetworkTable::Connection::Subscribe(std::string uri, const NetworkTable::SubscribeCallback &callback, \
+        const std::set<std::string> &fields) {
+    if (reconnect_ && socket_thread_.joinable() && AddCallbackBeforeConnected(uri, callback, fields)) {
+        return;
+    }
     if (!connected_) {
         throw NotConnectedException(const_cast<char*>("fail to subscribe"));
     }
@@ -229,119 +549,846 @@ void NetworkTable::Connection::Subscribe(std::string uri, \
 
     auto *subscribe_request = request.mutable_subscribe_request();
     subscribe_request->set_uri(uri);
-
-    try {
-        if (!Send(request, &mst_socket_)) {
-            throw TimeoutException(const_cast<char*>("subscribe send timed out"));
-        }
-
-        WaitForAck();
-    } catch (const zmq::error_t &e) {
-        if (signaled && e.num() == EINTR) {
-            InterruptManageSocketThread();
-            throw NetworkTable::InterruptedException("Received interrupt signal");
-        }
+    for (auto const &field : fields) {
+        subscribe_request->add_fields(field);
     }
 
+    auto reply = SendRequest(&request);
+    WaitForAck(request.id(), &reply);
+
     // Don't fill in our callback table until
     // after we get the ACK.
-    callbacks_[uri] = callback;
+    AddCallback(uri, callback, fields, use_fanout_ && fields.empty());
 }
 
-void NetworkTable::Connection::Unsubscribe(std::string uri) {
+std::future<void> NetworkTable::Connection::SubscribeAsync(const std::string &uri, \
+        const NetworkTable::SubscribeCallback &callback, \
+        const std::set<std::string> &fields) {
+    if (reconnect_ && socket_thread_.joinable() && AddCallbackBeforeConnected(uri, callback, fields)) {
+        std::promise<void> acked;
+        acked.set_value();
+        return acked.get_future();
+    }
     if (!connected_) {
-        throw NotConnectedException(const_cast<char*>("fail to unsubscribe"));
+        throw NotConnectedException(const_cast<char*>("fail to subscribe"));
     }
 
-    callbacks_.erase(uri);
-
     NetworkTable::Request request;
-    request.set_type(NetworkTable::Request::UNSUBSCRIBE);
+    request.set_type(NetworkTable::Request::SUBSCRIBE);
 
-    auto *unsubscribe_request = request.mutable_unsubscribe_request();
-    unsubscribe_request->set_uri(uri);
+    auto *subscribe_request = request.mutable_subscribe_request();
+    subscribe_request->set_uri(uri);
+    for (auto const &field : fields) {
+        subscribe_request->add_fields(field);
+    }
 
-    try {
-        if (!Send(request, &mst_socket_)) {
-            throw TimeoutException(const_cast<char*>("unsubscribe send timed out"));
+    bool via_fanout = use_fanout_ && fields.empty();
+    auto acked = std::make_shared<std::promise<void>>();
+    SendRequestAsync(&request, [this, acked, uri, callback, fields, via_fanout](\
+                std::exception_ptr error, const NetworkTable::Reply *) {
+        if (error) {
+            acked->set_exception(error);
+            return;
         }
+        AddCallback(uri, callback, fields, via_fanout);
+        acked->set_value();
+    });
+    return acked->get_future();
+}
 
-        WaitForAck();
-    } catch (const zmq::error_t &e) {
-        if (signaled && e.num() == EINTR) {
-            InterruptManageSocketThread();
-            throw NetworkTable::InterruptedException("Received interrupt signal");
+void NetworkTable::Connection::Unsubscribe(std::string uri) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to unsubscribe"));
+    }
+
+    bool cached;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        cached = cache_.count(uri) > 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        callbacks_.erase(uri);
+        if (!cached) {
+            shared_memory_uris_.erase(uri);
         }
     }
-}
 
-////////////////////// PRIVATE //////////////////////
+    // The cache still needs the subscription.
+    if (cached) {
+        return;
+    }
 
-int NetworkTable::Connection::Send(const NetworkTable::Request &request, zmq::socket_t *socket) {
-    // Serialize the message to a string
-    std::string serialized_request;
-    request.SerializeToString(&serialized_request);
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::UNSUBSCRIBE);
 
-    // Send the string to the server.
-    zmq::message_t message(serialized_request.length());
-    memcpy(message.data(), serialized_request.data(), serialized_request.length());
-    return socket->send(message);
+    auto *unsubscribe_request = request.mutable_unsubscribe_request();
+    unsubscribe_request->set_uri(uri);
+
+    auto reply = SendRequest(&request);
+    WaitForAck(request.id(), &reply);
 }
 
-int NetworkTable::Connection::Send(const NetworkTable::Reply &reply, zmq::socket_t *socket) {
-    // Serialize the message to a string
-    std::string serialized_request;
-    reply.SerializeToString(&serialized_request);
+std::future<void> NetworkTable::Connection::UnsubscribeAsync(const std::string &uri) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to unsubscribe"));
+    }
 
-    // Send the string to the server.
-    zmq::message_t message(serialized_request.length());
-    memcpy(message.data(), serialized_request.data(), serialized_request.length());
-    return socket->send(message);
-}
+    bool cached;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        cached = cache_.count(uri) > 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        callbacks_.erase(uri);
+        if (!cached) {
+            shared_memory_uris_.erase(uri);
+        }
+    }
 
-int NetworkTable::Connection::Receive(NetworkTable::Reply *reply, zmq::socket_t *socket) {
-    zmq::message_t message;
-    int rc = socket->recv(&message);
-    std::string serialized_reply(static_cast<char*>(message.data()), \
-                            message.size());
+    // The cache still needs the subscription.
+    if (cached) {
+        std::promise<void> acked;
+        acked.set_value();
+        return acked.get_future();
+    }
 
-    reply->ParseFromString(serialized_reply);
-    return rc;
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::UNSUBSCRIBE);
+    request.mutable_unsubscribe_request()->set_uri(uri);
+    return SendRequestForAck(&request);
 }
 
-int NetworkTable::Connection::Receive(NetworkTable::Request *request, zmq::socket_t *socket) {
-    zmq::message_t message;
-    int rc = socket->recv(&message);
-    std::string serialized_reply(static_cast<char*>(message.data()), \
-                            message.size());
+std::vector<std::map<std::string, NetworkTable::Node>> NetworkTable::Connection::SendBatch(\
+        const NetworkTable::Batch &batch) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to send batch"));
+    }
 
-    request->ParseFromString(serialized_reply);
-    return rc;
-}
+    // Like Unsubscribe, stop running callbacks right away,
+    // and keep the server subscription for uris which are cached.
+    // Those unsubscribes aren't sent at all.
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::BATCH);
+    std::vector<bool> sent;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        for (const auto &batch_request : batch.request_.batch_requests()) {
+            sent.push_back(batch_request.type() != NetworkTable::Request::UNSUBSCRIBE \
+                    || cache_.count(batch_request.unsubscribe_request().uri()) == 0);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        for (int i = 0; i < batch.request_.batch_requests_size(); i++) {
+            const NetworkTable::Request &batch_request = batch.request_.batch_requests(i);
+            bool cached = !sent[i];
+            if (batch_request.type() == NetworkTable::Request::UNSUBSCRIBE) {
+                const std::string &uri = batch_request.unsubscribe_request().uri();
+                callbacks_.erase(uri);
+                if (!cached) {
+                    shared_memory_uris_.erase(uri);
+                }
+            }
+            if (!cached) {
+                *request.add_batch_requests() = batch_request;
+            }
+        }
+    }
 
-void NetworkTable::Connection::CheckForError(const NetworkTable::Reply &reply) {
-    if (reply.type() == NetworkTable::Reply::ERROR) {
-        if (reply.has_error_reply()) {
-            NetworkTable::ErrorReply error_reply = reply.error_reply();
-            if (error_reply.type() == NetworkTable::ErrorReply::NODE_NOT_FOUND) {
-                throw NetworkTable::NodeNotFoundException(error_reply.message_data());
+    auto future_reply = SendRequest(&request);
+    NetworkTable::Reply reply = WaitForReply(request.id(), &future_reply);
+
+    // Go through the replies in order, so that subscribing then
+    // unsubscribing a uri in the same batch ends up unsubscribed.
+    std::vector<std::map<std::string, NetworkTable::Node>> results;
+    size_t next_callback = 0;
+    int first_error = -1;
+    int reply_index = 0;
+    for (int i = 0; i < batch.request_.batch_requests_size(); i++) {
+        const NetworkTable::Request &batch_request = batch.request_.batch_requests(i);
+        if (!sent[i]) {
+            // Only the callback goes, see above.
+            std::lock_guard<std::mutex> lock(callbacks_mutex_);
+            callbacks_.erase(batch_request.unsubscribe_request().uri());
+            continue;
+        }
+        if (reply_index >= reply.batch_replies_size()) {
+            break;
+        }
+        const NetworkTable::Reply &batch_reply = reply.batch_replies(reply_index);
+        if (batch_reply.type() == NetworkTable::Reply::ERROR && first_error == -1) {
+            first_error = reply_index;
+        }
+        reply_index++;
+
+        switch (batch_request.type()) {
+            case NetworkTable::Request::GETNODES: {
+                std::map<std::string, NetworkTable::Node> nodes;
+                for (auto const &entry : batch_reply.getnodes_reply().nodes()) {
+                    nodes[entry.first] = entry.second;
+                }
+                results.push_back(nodes);
+                break;
             }
-        } else {
-            throw std::runtime_error("Server replied with unset error message.");
+            case NetworkTable::Request::SUBSCRIBE: {
+                const auto &fields = batch_request.subscribe_request().fields();
+                AddCallback(batch_request.subscribe_request().uri(), batch.callbacks_[next_callback++], \
+                        std::set<std::string>(fields.begin(), fields.end()), false);
+                break;
+            }
+            case NetworkTable::Request::UNSUBSCRIBE: {
+                std::lock_guard<std::mutex> lock(callbacks_mutex_);
+                callbacks_.erase(batch_request.unsubscribe_request().uri());
+                shared_memory_uris_.erase(batch_request.unsubscribe_request().uri());
+                break;
+            }
+            default: break;
         }
     }
+
+    if (first_error != -1) {
+        CheckForError(reply.batch_replies(first_error));
+    }
+    return results;
 }
 
-void NetworkTable::Connection::WaitForAck() {
-    NetworkTable::Reply reply;
-    if (!Receive(&reply, &mst_socket_)) {
-        throw TimeoutException(const_cast<char*>("ack timed out"));
+void NetworkTable::Connection::Cache(const std::string &uri) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to cache"));
     }
-    if (reply.type() != NetworkTable::Reply::ACK) {
-        throw std::runtime_error(const_cast<char*>(\
-                "received non-ack from server while expecting an ack"));
+
+    // Add the entry before subscribing, so that
+    // updates which arrive right after the ack aren't missed.
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        if (cache_.count(uri) > 0) {
+            return;
+        }
+        cache_[uri] = NetworkTable::CachedNode{NetworkTable::Node(), 0, \
+            std::chrono::steady_clock::time_point()};
+    }
+    if (notification_ring_.IsOpen() && !use_fanout_) {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        shared_memory_uris_.insert(uri);
     }
-}
+
+    try {
+        NetworkTable::Request request;
+        request.set_type(NetworkTable::Request::SUBSCRIBE);
+        request.mutable_subscribe_request()->set_uri(uri);
+
+        auto reply = SendRequest(&request);
+        WaitForAck(request.id(), &reply);
+
+        // The server doesn't send the node until it changes, so get it now.
+        // This is skipped while the cache entry has no copy (version 0).
+        std::set<std::string> uris = {uri};
+        NetworkTable::Node node = GetNodes(uris)[uri];
+
+        // If an update arrived while we were getting the node,
+        // it is at least as new as this copy.
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto entry = cache_.find(uri);
+        if (entry != cache_.end() && entry->second.version == 0) {
+            entry->second.node = node;
+            entry->second.version = 1;
+            entry->second.updated = std::chrono::steady_clock::now();
+        }
+    } catch (const NetworkTable::NodeNotFoundException &) {
+        // Nothing has been written to uri yet. Gets go to
+        // the server until the first update arrives.
+    } catch (...) {
+        // Any update the server still sends
+        // for uri is dropped, like after Unsubscribe.
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            cache_.erase(uri);
+        }
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        if (callbacks_.count(uri) == 0) {
+            shared_memory_uris_.erase(uri);
+        }
+        throw;
+    }
+}
+
+void NetworkTable::Connection::Uncache(const std::string &uri) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to uncache"));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        if (cache_.erase(uri) == 0) {
+            return;
+        }
+    }
+
+    // Keep the subscription if there is a callback for it.
+    {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        if (callbacks_.count(uri) > 0) {
+            return;
+        }
+        shared_memory_uris_.erase(uri);
+    }
+
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::UNSUBSCRIBE);
+    request.mutable_unsubscribe_request()->set_uri(uri);
+
+    auto reply = SendRequest(&request);
+    WaitForAck(request.id(), &reply);
+}
+
+bool NetworkTable::Connection::GetCachedNode(const std::string &uri, NetworkTable::CachedNode *cached_node) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    for (auto &entry : cache_) {
+        if (entry.second.version == 0 || !NetworkTable::IsDescendant(uri, entry.first)) {
+            continue;
+        }
+
+        cached_node->node = NetworkTable::GetNode(NetworkTable::RelativeUri(uri, entry.first), \
+                &entry.second.node);
+        cached_node->version = entry.second.version;
+        cached_node->updated = entry.second.updated;
+        return true;
+    }
+    return false;
+}
+
+void NetworkTable::Batch::SetValue(const std::string &uri, const NetworkTable::Value &value) {
+    SetValues({{uri, value}});
+}
+
+void NetworkTable::Batch::SetValues(const std::map<std::string, NetworkTable::Value> &values) {
+    request_.set_type(NetworkTable::Request::BATCH);
+    auto *batch_request = request_.add_batch_requests();
+    batch_request->set_type(NetworkTable::Request::SETVALUES);
+
+    auto mutable_values = batch_request->mutable_setvalues_request()->mutable_values();
+    for (auto const &entry : values) {
+        (*mutable_values)[entry.first] = entry.second;
+    }
+}
+
+void NetworkTable::Batch::GetNodes(const std::set<std::string> &uris) {
+    request_.set_type(NetworkTable::Request::BATCH);
+    auto *batch_request = request_.add_batch_requests();
+    batch_request->set_type(NetworkTable::Request::GETNODES);
+
+    auto *getnodes_request = batch_request->mutable_getnodes_request();
+    for (auto const &uri : uris) {
+        getnodes_request->add_uris(uri);
+    }
+}
+
+void NetworkTable::Batch::Subscribe(const std::string &uri, const NetworkTable::SubscribeCallback &callback, \
+        const std::set<std::string> &fields) {
+    request_.set_type(NetworkTable::Request::BATCH);
+    auto *batch_request = request_.add_batch_requests();
+    batch_request->set_type(NetworkTable::Request::SUBSCRIBE);
+
+    auto *subscribe_request = batch_request->mutable_subscribe_request();
+    subscribe_request->set_uri(uri);
+    for (auto const &field : fields) {
+        subscribe_request->add_fields(field);
+    }
+    callbacks_.push_back(callback);
+}
+
+void NetworkTable::Batch::Unsubscribe(const std::string &uri) {
+    request_.set_type(NetworkTable::Request::BATCH);
+    auto *batch_request = request_.add_batch_requests();
+    batch_request->set_type(NetworkTable::Request::UNSUBSCRIBE);
+    batch_request->mutable_unsubscribe_request()->set_uri(uri);
+}
+
+////////////////////// PRIVATE //////////////////////
+
+int NetworkTable::Connection::Send(const NetworkTable::Request &request, zmq::socket_t *socket) {
+    // Serialize straight into the message, so the
+    // bytes sent are the only copy we make.
+    zmq::message_t message(request.ByteSizeLong());
+    request.SerializeWithCachedSizesToArray(static_cast<uint8_t*>(message.data()));
+    bytes_sent_ += message.size();
+    return socket->send(message);
+}
+
+int NetworkTable::Connection::Send(const NetworkTable::Reply &reply, zmq::socket_t *socket) {
+    zmq::message_t message(reply.ByteSizeLong());
+    reply.SerializeWithCachedSizesToArray(static_cast<uint8_t*>(message.data()));
+    bytes_sent_ += message.size();
+    return socket->send(message);
+}
+
+int NetworkTable::Connection::Receive(NetworkTable::Reply *reply, zmq::socket_t *socket) {
+    zmq::message_t message;
+    int rc = socket->recv(&message);
+    bytes_received_ += message.size();
+
+    // Parse straight out of the message's buffer.
+    reply->ParseFromArray(message.data(), message.size());
+    return rc;
+}
+
+int NetworkTable::Connection::Receive(NetworkTable::Request *request, zmq::socket_t *socket) {
+    zmq::message_t message;
+    int rc = socket->recv(&message);
+    bytes_received_ += message.size();
+
+    request->ParseFromArray(message.data(), message.size());
+    return rc;
+}
+
+void NetworkTable::Connection::SendSetValues(NetworkTable::Request *request) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to set value"));
+    }
+
+    if (write_buffer_interval_millis_ > 0) {
+        const auto &request_values = request->setvalues_request().values();
+        BufferValues(std::map<std::string, NetworkTable::Value>(request_values.begin(), request_values.end()));
+        return;
+    }
+
+    auto reply = SendRequest(request);
+    WaitForAck(request->id(), &reply);
+}
+
+NetworkTable::ModifyValueReply NetworkTable::Connection::ModifyValue(\
+        const NetworkTable::ModifyValueRequest &modifyvalue_request) {
+    if (!connected_) {
+        throw NotConnectedException(const_cast<char*>("fail to modify value"));
+    }
+
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::MODIFYVALUE);
+    *request.mutable_modifyvalue_request() = modifyvalue_request;
+
+    auto future_reply = SendRequest(&request);
+    NetworkTable::Reply reply = WaitForReply(request.id(), &future_reply);
+    return reply.modifyvalue_reply();
+}
+
+void NetworkTable::Connection::AddCallback(const std::string &uri, \
+        const NetworkTable::SubscribeCallback &callback, const std::set<std::string> &fields, bool via_fanout) {
+    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+    callbacks_[uri] = Subscription{callback, fields};
+
+    // The server writes whole node replies to shared memory,
+    // unless they're going through the fan-out socket.
+    if (notification_ring_.IsOpen() && fields.empty() && !via_fanout) {
+        shared_memory_uris_.insert(uri);
+    } else {
+        shared_memory_uris_.erase(uri);
+    }
+}
+
+bool NetworkTable::Connection::AddCallbackBeforeConnected(const std::string &uri, \
+        const NetworkTable::SubscribeCallback &callback, const std::set<std::string> &fields) {
+    // The manage socket thread sets connected_ before it
+    // takes this lock to replay subscriptions, so either
+    // it sees this callback, or we see connected_.
+    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+    if (connected_) {
+        return false;
+    }
+    callbacks_[uri] = Subscription{callback, fields};
+    return true;
+}
+
+void NetworkTable::Connection::HandleSubscribeReply(const NetworkTable::Reply &reply) {
+    std::string uri = reply.subscribe_reply().uri();
+    NetworkTable::Node node = reply.subscribe_reply().node();
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto entry = cache_.find(uri);
+        if (entry != cache_.end()) {
+            entry->second.node = node;
+            entry->second.version++;
+            entry->second.updated = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Even after sending an Unsubscribe request,
+    // it can take a while for that request to be processed
+    // if other processes are also sending requests to the server.
+    // If one of these other requests happens to update
+    // a value which was subscribed to by this process,
+    // a SubscribeReply can still be sent by the server,
+    // even though this process just sent an UnsubscribeRequest
+    // to the server.
+    {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        if (callbacks_.count(uri) == 0) {
+            return;
+        }
+    }
+
+    bool is_self_reply = \
+      reply.subscribe_reply().responsible_socket() == socket_filepath_;
+
+    std::map<std::string, NetworkTable::Value> diffs;
+    for (const auto &diff : reply.subscribe_reply().diffs()) {
+        diffs[diff.first] = diff.second;
+    }
+
+    // With callback threads, this can run a while from now,
+    // so look the callback up when it does, in case
+    // the uri was unsubscribed from in the meantime.
+    auto received = std::chrono::steady_clock::now();
+    callback_executor_.Run(uri, [this, uri, node = std::move(node), diffs = std::move(diffs), is_self_reply, \
+            received] {
+        NetworkTable::SubscribeCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(callbacks_mutex_);
+            auto entry = callbacks_.find(uri);
+            if (entry != callbacks_.end()) {
+                callback = entry->second.callback;
+            }
+        }
+        if (callback) {
+            auto started = std::chrono::steady_clock::now();
+            callback_dispatch_latency_.Record(started - received);
+            callback(node, diffs, is_self_reply);
+            callback_run_latency_.RecordSince(started);
+        }
+    });
+}
+
+void NetworkTable::Connection::GetCachedNodes(std::set<std::string> *uris, \
+        std::map<std::string, NetworkTable::Node> *nodes) {
+    NetworkTable::CachedNode cached_node;
+    for (auto uri = uris->begin(); uri != uris->end();) {
+        if (GetCachedNode(*uri, &cached_node)) {
+            (*nodes)[*uri] = cached_node.node;
+            uri = uris->erase(uri);
+        } else {
+            ++uri;
+        }
+    }
+}
+
+void NetworkTable::Connection::GetCachedValues(std::set<std::string> *uris, \
+        std::map<std::string, NetworkTable::Value> *values) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    for (auto uri = uris->begin(); uri != uris->end();) {
+        bool is_cached = false;
+        for (auto &entry : cache_) {
+            if (entry.second.version > 0 && NetworkTable::IsDescendant(*uri, entry.first)) {
+                (*values)[*uri] = NetworkTable::GetValue(NetworkTable::RelativeUri(*uri, entry.first), \
+                        &entry.second.node);
+                is_cached = true;
+                break;
+            }
+        }
+
+        if (is_cached) {
+            uri = uris->erase(uri);
+        } else {
+            ++uri;
+        }
+    }
+}
+
+void NetworkTable::Connection::ReadSharedMemory() {
+    std::string topic;
+    std::string serialized_reply;
+    std::unique_ptr<char[]> arena_block(new char[kArenaBlockSize_]);
+    google::protobuf::Arena arena(ArenaOptionsWithBlock(arena_block.get(), kArenaBlockSize_));
+    while (reading_shared_memory_) {
+        switch (notification_ring_.Read(&topic, &serialized_reply)) {
+            case NetworkTable::SharedMemoryRing::EMPTY: {
+                // Wake up every so often to check if
+                // we should stop.
+                notification_ring_.Wait(100);
+                break;
+            }
+            case NetworkTable::SharedMemoryRing::OVERRUN: {
+                std::cout << "Fell behind reading subscribe replies from shared memory, "
+                          << "some were lost" << std::endl;
+                break;
+            }
+            case NetworkTable::SharedMemoryRing::MESSAGE: {
+                last_shared_memory_message_ = std::chrono::steady_clock::now().time_since_epoch().count();
+
+                // Replies for every client are in shared memory,
+                // so skip the ones we didn't subscribe to without parsing them.
+                {
+                    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+                    if (shared_memory_uris_.count(topic) == 0) {
+                        continue;
+                    }
+                }
+                bytes_received_ += serialized_reply.size();
+
+                NetworkTable::Reply &reply = \
+                    *google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(&arena);
+                if (reply.ParseFromString(serialized_reply) \
+                        && reply.type() == NetworkTable::Reply::SUBSCRIBE \
+                        && reply.has_subscribe_reply()) {
+                    HandleSubscribeReply(reply);
+                }
+                arena.Reset();
+                break;
+            }
+        }
+    }
+}
+
+void NetworkTable::Connection::StartReadingSharedMemory() {
+    if (notification_ring_.IsOpen()) {
+        reading_shared_memory_ = true;
+        shared_memory_thread_ = std::thread(&NetworkTable::Connection::ReadSharedMemory, this);
+    }
+}
+
+void NetworkTable::Connection::StopReadingSharedMemory() {
+    if (shared_memory_thread_.joinable()) {
+        reading_shared_memory_ = false;
+        shared_memory_thread_.join();
+    }
+}
+
+void NetworkTable::Connection::QueueRequest(const NetworkTable::Request &request) {
+    // Serialize here rather than on the manage socket thread,
+    // so that busy callers don't hold each other up.
+    QueuedRequest queued_request;
+    queued_request.message.rebuild(request.ByteSizeLong());
+    request.SerializeWithCachedSizesToArray(static_cast<uint8_t*>(queued_request.message.data()));
+    if (use_fanout_ && (request.type() == NetworkTable::Request::SUBSCRIBE \
+                || request.type() == NetworkTable::Request::UNSUBSCRIBE)) {
+        queued_request.subscription = std::make_shared<NetworkTable::Request>(request);
+    }
+    queued_request.queued = std::chrono::steady_clock::now();
+    request_queue_.Push(std::move(queued_request));
+}
+
+void NetworkTable::Connection::SendQueuedRequests(zmq::socket_t *socket, zmq::socket_t *fanout_socket, \
+        std::set<std::string> *fanout_uris, \
+        std::map<std::string, std::vector<uint64_t>> *unconfirmed_fanout_uris) {
+    std::vector<QueuedRequest> queued_requests;
+    request_queue_.PopAll(&queued_requests);
+    for (auto &queued_request : queued_requests) {
+        queue_wait_latency_.RecordSince(queued_request.queued);
+
+        // Subscriptions to whole nodes go through the fan-out
+        // socket if it's enabled. These are acked once the
+        // server's XPUB socket confirms it has seen the
+        // subscription, see ConfirmFanoutSubscription.
+        const NetworkTable::Request *request = queued_request.subscription.get();
+        if (request != nullptr && request->type() == NetworkTable::Request::SUBSCRIBE) {
+            const std::string &uri = request->subscribe_request().uri();
+            std::string topic = uri + '\0';
+            if (request->subscribe_request().fields_size() == 0) {
+                if (fanout_uris->insert(uri).second) {
+                    fanout_socket->setsockopt(ZMQ_SUBSCRIBE, topic.data(), topic.size());
+                    unconfirmed_fanout_uris->emplace(uri, std::vector<uint64_t>());
+                }
+                // ZMQ only sends the first subscription to a topic
+                // upstream, so if this uri is already confirmed
+                // there is nothing to wait for.
+                auto unconfirmed = unconfirmed_fanout_uris->find(uri);
+                if (unconfirmed != unconfirmed_fanout_uris->end()) {
+                    unconfirmed->second.push_back(request->id());
+                } else {
+                    DeliverReply(MakeAck(request->id()));
+                }
+                continue;
+            } else if (fanout_uris->erase(uri) > 0) {
+                // Switching to a projection, which the
+                // fan-out socket can't do.
+                fanout_socket->setsockopt(ZMQ_UNSUBSCRIBE, topic.data(), topic.size());
+                ConfirmFanoutSubscription(uri, unconfirmed_fanout_uris);
+            }
+        } else if (request != nullptr && request->type() == NetworkTable::Request::UNSUBSCRIBE \
+                && fanout_uris->erase(request->unsubscribe_request().uri()) > 0) {
+            const std::string &uri = request->unsubscribe_request().uri();
+            std::string topic = uri + '\0';
+            fanout_socket->setsockopt(ZMQ_UNSUBSCRIBE, topic.data(), topic.size());
+            ConfirmFanoutSubscription(uri, unconfirmed_fanout_uris);
+            DeliverReply(MakeAck(request->id()));
+            continue;
+        }
+
+        bytes_sent_ += queued_request.message.size();
+        socket->send(queued_request.message);
+    }
+}
+
+void NetworkTable::Connection::ConfirmFanoutSubscription(const std::string &uri, \
+        std::map<std::string, std::vector<uint64_t>> *unconfirmed_fanout_uris) {
+    auto unconfirmed = unconfirmed_fanout_uris->find(uri);
+    if (unconfirmed == unconfirmed_fanout_uris->end()) {
+        return;
+    }
+    for (uint64_t id : unconfirmed->second) {
+        DeliverReply(MakeAck(id));
+    }
+    unconfirmed_fanout_uris->erase(unconfirmed);
+}
+
+void NetworkTable::Connection::DropQueuedRequests() {
+    std::vector<QueuedRequest> queued_requests;
+    request_queue_.PopAll(&queued_requests);
+}
+
+void NetworkTable::Connection::SendRequest(NetworkTable::Request *request, \
+        std::function<void(const NetworkTable::Reply *reply)> on_reply) {
+    uint64_t id = next_request_id_++;
+    request->set_id(id);
+    request->set_priority(priority_);
+    NetworkTable::LatencyHistogram *latency = LatencyFor(request->type());
+    if (latency != nullptr) {
+        auto sent = std::chrono::steady_clock::now();
+        on_reply = [on_reply, latency, sent](const NetworkTable::Reply *reply) {
+            if (reply != nullptr) {
+                latency->RecordSince(sent);
+            }
+            on_reply(reply);
+        };
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        pending_requests_[id] = on_reply;
+    }
+
+    QueueRequest(*request);
+}
+
+std::future<NetworkTable::Reply> NetworkTable::Connection::SendRequest(NetworkTable::Request *request) {
+    auto reply_promise = std::make_shared<std::promise<NetworkTable::Reply>>();
+    SendRequest(request, [reply_promise](const NetworkTable::Reply *reply) {
+        if (reply == nullptr) {
+            reply_promise->set_exception(std::make_exception_ptr(\
+                    NotConnectedException("disconnected while waiting for reply")));
+        } else {
+            reply_promise->set_value(*reply);
+        }
+    });
+    return reply_promise->get_future();
+}
+
+void NetworkTable::Connection::SendRequestAsync(NetworkTable::Request *request, \
+        std::function<void(std::exception_ptr error, const NetworkTable::Reply *reply)> on_done) {
+    SendRequest(request, [this, on_done](const NetworkTable::Reply *reply) {
+        if (reply == nullptr) {
+            on_done(std::make_exception_ptr(\
+                    NotConnectedException("disconnected while waiting for reply")), nullptr);
+            return;
+        }
+
+        std::exception_ptr error;
+        try {
+            CheckForError(*reply);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        on_done(error, reply);
+    });
+}
+
+std::future<void> NetworkTable::Connection::SendRequestForAck(NetworkTable::Request *request) {
+    auto acked = std::make_shared<std::promise<void>>();
+    SendRequestAsync(request, [acked](std::exception_ptr error, const NetworkTable::Reply *) {
+        if (error) {
+            acked->set_exception(error);
+        } else {
+            acked->set_value();
+        }
+    });
+    return acked->get_future();
+}
+
+NetworkTable::Reply NetworkTable::Connection::WaitForReply(uint64_t id, \
+        std::future<NetworkTable::Reply> *reply) {
+    // Wait in small steps, so that we notice
+    // if we get interrupted.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_millis_);
+    while (reply->wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+        bool timed_out = timeout_millis_ != -1 && std::chrono::steady_clock::now() >= deadline;
+        if (signaled || timed_out) {
+            // Stop waiting for it, so that if the reply
+            // turns up later, it gets dropped.
+            {
+                std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+                pending_requests_.erase(id);
+            }
+            if (signaled) {
+                InterruptManageSocketThread();
+                throw NetworkTable::InterruptedException("Received interrupt signal");
+            }
+            timeouts_++;
+            throw TimeoutException(const_cast<char*>("reply timed out"));
+        }
+    }
+
+    NetworkTable::Reply received = reply->get();
+    CheckForError(received);
+    return received;
+}
+
+void NetworkTable::Connection::DeliverReply(const NetworkTable::Reply &reply) {
+    std::function<void(const NetworkTable::Reply *)> on_reply;
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        auto pending = pending_requests_.find(reply.id());
+        if (pending == pending_requests_.end()) {
+            // Heartbeat replies have no id.
+            if (reply.id() != 0) {
+                stale_replies_++;
+            }
+            return;
+        }
+        on_reply = pending->second;
+        pending_requests_.erase(pending);
+    }
+    on_reply(&reply);
+}
+
+void NetworkTable::Connection::FailPendingRequests() {
+    std::map<uint64_t, std::function<void(const NetworkTable::Reply *)>> pending_requests;
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        std::swap(pending_requests, pending_requests_);
+    }
+    for (auto &entry : pending_requests) {
+        entry.second(nullptr);
+    }
+}
+
+NetworkTable::Reply NetworkTable::Connection::MakeAck(uint64_t id) {
+    NetworkTable::Reply reply;
+    reply.set_type(NetworkTable::Reply::ACK);
+    reply.set_id(id);
+    return reply;
+}
+
+void NetworkTable::Connection::CheckForError(const NetworkTable::Reply &reply) {
+    if (reply.type() == NetworkTable::Reply::ERROR) {
+        if (reply.has_error_reply()) {
+            NetworkTable::ErrorReply error_reply = reply.error_reply();
+            if (error_reply.type() == NetworkTable::ErrorReply::NODE_NOT_FOUND) {
+                throw NetworkTable::NodeNotFoundException(error_reply.message_data());
+            }
+            throw std::runtime_error(error_reply.message_data());
+        } else {
+            throw std::runtime_error("Server replied with unset error message.");
+        }
+    }
+}
+
+void NetworkTable::Connection::WaitForAck(uint64_t id, std::future<NetworkTable::Reply> *future_reply) {
+    NetworkTable::Reply reply = WaitForReply(id, future_reply);
+    if (reply.type() != NetworkTable::Reply::ACK) {
+        throw std::runtime_error(const_cast<char*>(\
+                "received non-ack from server while expecting an ack"));
+    }
+}
 
 void NetworkTable::Connection::InterruptManageSocketThread() {
     // It turns out when you send an interrupt signal,
@@ -352,6 +1399,13 @@ void NetworkTable::Connection::InterruptManageSocketThread() {
     // to listen to the main thread socket, as well as any other socket.
     // If we do get an interrupt, we can tell the manage socket thread to die,
     // avoiding any memory leaks.
+    // Any number of threads can be interrupted at once,
+    // only the first one needs to do this.
+    std::lock_guard<std::recursive_mutex> lock(mst_socket_mutex_);
+    if (!socket_thread_.joinable()) {
+        return;
+    }
+
     std::string interrupt_string = "interrupted";
     zmq::message_t interrupt_msg(interrupt_string.size()+1);
     memcpy(interrupt_msg.data(), interrupt_string.c_str(), interrupt_string.size()+1);
@@ -359,128 +1413,473 @@ void NetworkTable::Connection::InterruptManageSocketThread() {
     socket_thread_.join();
 }
 
-void NetworkTable::Connection::ManageSocket(int timeout_millis, bool async) {
-    /*
-     * The context must be created here so that
-     * its destructor is called when this function
-     * ends. For more info see:
-     * http://zeromq.org/whitepapers:0mq-termination
-     */
-    zmq::socket_t socket(context_, ZMQ_PAIR);
+void NetworkTable::Connection::BufferValues(const std::map<std::string, NetworkTable::Value> &values) {
+    bool is_full;
+    {
+        std::lock_guard<std::mutex> lock(write_buffer_mutex_);
+        for (const auto &entry : values) {
+            write_buffer_[entry.first] = entry.second;
+        }
+        is_full = write_buffer_.size() >= write_buffer_max_values_;
+    }
+
+    if (is_full) {
+        RequestFlush();
+    }
+}
+
+void NetworkTable::Connection::RequestFlush() {
+    std::string request_body = "flush";
+    zmq::message_t request(request_body.size()+1);
+    memcpy(request.data(), request_body.c_str(), request_body.size()+1);
+    std::lock_guard<std::recursive_mutex> lock(mst_socket_mutex_);
+    try {
+        if (!mst_socket_.send(request)) {
+            throw TimeoutException(const_cast<char*>("flush timed out"));
+        }
+    } catch (const zmq::error_t &e) {
+        if (signaled && e.num() == EINTR) {
+            InterruptManageSocketThread();
+            throw NetworkTable::InterruptedException("Received interrupt signal");
+        }
+        throw;
+    }
+}
+
+void NetworkTable::Connection::FlushWriteBuffer(zmq::socket_t *socket) {
+    std::map<std::string, NetworkTable::Value> values;
+    std::vector<std::shared_ptr<std::promise<NetworkTable::Reply>>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(write_buffer_mutex_);
+        std::swap(values, write_buffer_);
+        std::swap(waiters, flush_waiters_);
+    }
+
+    if (values.empty()) {
+        for (auto &waiter : waiters) {
+            waiter->set_value(MakeAck(0));
+        }
+        return;
+    }
+
+    NetworkTable::Request request;
+    MakeSetValuesRequest(values, &request);
+    request.set_priority(priority_);
+    uint64_t id = next_request_id_++;
+    request.set_id(id);
+    auto sent = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        pending_requests_[id] = [this, waiters, sent](const NetworkTable::Reply *reply) {
+            if (reply != nullptr) {
+                set_latency_.RecordSince(sent);
+            }
+            if (reply != nullptr && reply->type() == NetworkTable::Reply::ERROR && waiters.empty()) {
+                std::cout << "Failed to set buffered values: " \
+                          << reply->error_reply().message_data() << std::endl;
+            }
+            for (auto &waiter : waiters) {
+                if (reply == nullptr) {
+                    waiter->set_exception(std::make_exception_ptr(\
+                            NotConnectedException("disconnected before buffered values were acked")));
+                } else {
+                    waiter->set_value(*reply);
+                }
+            }
+        };
+    }
+    Send(request, socket);
+}
+
+NetworkTable::Connection::SessionResult NetworkTable::Connection::OpenSession(\
+        std::unique_ptr<zmq::socket_t> *socket, zmq::socket_t *mt_socket, int timeout_millis) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Start each session on a new socket, so that nothing
+    // left over from the last one is sent to the server.
+    socket->reset(new zmq::socket_t(context_, use_router_ ? ZMQ_DEALER : ZMQ_PAIR));
     // Ensure that the destructor for
     // socket does not block and simply
     // discards any messages it is still trying to
     // send/receive:
-    socket.setsockopt(ZMQ_LINGER, 0);
+    (*socket)->setsockopt(ZMQ_LINGER, 0);
 
-    // This socket will be used to talk
-    // to the main thread.
-    zmq::socket_t mt_socket(context_, ZMQ_PAIR);
-    mt_socket.connect("inproc://#1");
+    // The server tells router clients apart by their
+    // routing id. Pick it ourselves, so it stays the
+    // same if the server restarts and we reconnect.
+    if (use_router_) {
+        (*socket)->setsockopt(ZMQ_IDENTITY, routing_id_.data(), routing_id_.size());
+    }
 
-    // Connect to the server
-    {
-        // First, send a request to Network Table Server
-        // to get a location to connect to. This is done
-        // using request/reply sockets.
-        zmq::socket_t init_socket(context_, ZMQ_REQ);
-        // Ensure that the destructor for
-        // init_socket does not block and simply
-        // discards any messages it is still trying to
-        // send/receive:
-        init_socket.setsockopt(ZMQ_LINGER, 0);
-
-        // In synchronous mode, we wait some time for the server
-        // to reply, and then possibly timeout.
-        // In async mode, we wait forever to the server to
-        // reply. It might not even be up yet. However,
-        // the main thread is not blocked, and continuous on
-        // while we wait to connect to the server here.
-        if (!async) {
-            init_socket.setsockopt(ZMQ_RCVTIMEO, timeout_millis);
-        } else {
-            init_socket.setsockopt(ZMQ_RCVTIMEO, -1);
-        }
+    // Notice if the link to a remote server silently drops,
+    // rather than waiting on it forever.
+    if (!tcp_host_.empty()) {
+        (*socket)->setsockopt(ZMQ_TCP_KEEPALIVE, 1);
+    }
+
+    // First, send a request to Network Table Server
+    // to get a location to connect to. This is done
+    // using request/reply sockets.
+    // Router clients skip this, and send the
+    // connect request on their own socket.
+    zmq::socket_t init_socket(context_, ZMQ_REQ);
+    // Ensure that the destructor for
+    // init_socket does not block and simply
+    // discards any messages it is still trying to
+    // send/receive:
+    init_socket.setsockopt(ZMQ_LINGER, 0);
+
+    // Zmq keeps trying to reach the server in the background,
+    // so try often, to find it soon after it comes back.
+    if (reconnect_) {
+        (*socket)->setsockopt(ZMQ_RECONNECT_IVL, kMinReconnectMillis_);
+        init_socket.setsockopt(ZMQ_RECONNECT_IVL, kMinReconnectMillis_);
+    }
+
+    zmq::socket_t *connect_socket = &init_socket;
+    if (!tcp_host_.empty()) {
+        connect_socket = socket->get();
+        (*socket)->connect("tcp://" + tcp_host_ + ":" + std::to_string(tcp_port_));
+    } else if (use_router_) {
+        connect_socket = socket->get();
+        (*socket)->connect("ipc://" + kWelcome_Directory_ + "NetworkTableRouter");
+    } else {
         init_socket.connect("ipc://" + kWelcome_Directory_ + "NetworkTable");
+    }
 
-        {
-            // The request body must be "connect"
-            // in order for the server to reply.
-            std::string request_body = "connect";
-            zmq::message_t request(request_body.size()+1);
-            memcpy(request.data(), request_body.c_str(), request_body.size()+1);
-            init_socket.send(request);
+    {
+        // The request body must be "connect"
+        // in order for the server to reply.
+        // If we can read subscribe replies from shared memory,
+        // tell the server to put them there. Over TCP, the
+        // shared memory here may not even be our server's.
+        // A restarted server makes new shared memory,
+        // so this is opened again for every session.
+        std::string request_body = "connect";
+        if (use_shared_memory_ && tcp_host_.empty()) {
+            try {
+                notification_ring_.Open(kSharedMemoryName_);
+                request_body = "connect shared_memory";
+            } catch (const std::runtime_error &e) {
+                std::cout << "Not using shared memory: " << e.what() << std::endl;
+            }
         }
+        zmq::message_t request(request_body.size()+1);
+        memcpy(request.data(), request_body.c_str(), request_body.size()+1);
+        connect_socket->send(request);
+    }
 
-        zmq::message_t reply;
+    // Listen to the master socket, and the init socket.
+    // We need to listen to the master socket because
+    // it will tell us if the program got an interrupt signal,
+    // in which case we clean up our thread and return.
+    std::vector<zmq::pollitem_t> pollitems;
 
-        // Listen to the master socket, and the init socket.
-        // We need to listen to the master socket because
-        // it will tell us if the program got an interrupt signal,
-        // in which case we clean up our thread and return.
-        std::vector<zmq::pollitem_t> pollitems;
+    zmq::pollitem_t mt_pollitem;
+    mt_pollitem.socket = static_cast<void*>(*mt_socket);
+    mt_pollitem.events = ZMQ_POLLIN;
+    pollitems.push_back(mt_pollitem);
 
-        zmq::pollitem_t mt_pollitem;
-        mt_pollitem.socket = static_cast<void*>(mt_socket);
-        mt_pollitem.events = ZMQ_POLLIN;
-        pollitems.push_back(mt_pollitem);
+    zmq::pollitem_t init_pollitem;
+    init_pollitem.socket = static_cast<void*>(*connect_socket);
+    init_pollitem.events = ZMQ_POLLIN;
+    pollitems.push_back(init_pollitem);
 
-        zmq::pollitem_t init_pollitem;
-        init_pollitem.socket = static_cast<void*>(init_socket);
-        init_pollitem.events = ZMQ_POLLIN;
-        pollitems.push_back(init_pollitem);
+    zmq::message_t reply;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_millis);
+    while (true) {
+        long wait_millis = -1;  // NOLINT(runtime/int)
+        if (timeout_millis != -1) {
+            wait_millis = std::max(0L, static_cast<long>(\
+                std::chrono::duration_cast<std::chrono::milliseconds>(\
+                    deadline - std::chrono::steady_clock::now()).count()));  // NOLINT(runtime/int)
+        }
+        zmq::poll(pollitems.data(), pollitems.size(), wait_millis);
 
-        zmq::poll(pollitems.data(), 2, -1);
+        // The server replies with a location to connect to.
+        // after this, this ZMQ_REQ socket is no longer needed.
+        if (pollitems[1].revents & ZMQ_POLLIN) {
+            connect_socket->recv(&reply);
+            break;
+        }
 
         if (pollitems[0].revents & ZMQ_POLLIN) {
-            mt_socket.recv(&reply);
-            /*
-             * This looks jank (convert c string to std::string and then back),
-             * but for some reason I had to do this (can't remember why. maybe you can fix it?)
-             */
-            std::string message_data(static_cast<char*>(reply.data()), reply.size());
-            if (strcmp(message_data.c_str(), "interrupted") == 0) {
+            zmq::message_t message;
+            mt_socket->recv(&message);
+            if (MessageIs(message, "interrupted")) {
+                return SESSION_INTERRUPTED;
+            }
+            if (MessageIs(message, "disconnect")) {
+                return SESSION_DISCONNECTED;
+            }
+            // Buffered values are flushed once we're connected.
+            continue;
+        }
+
+        if (timeout_millis != -1 && std::chrono::steady_clock::now() >= deadline) {
+            return SESSION_TIMED_OUT;
+        }
+    }
+
+    // Connect to the ZMQ_PAIR socket which was created
+    // by the server. Router clients are already connected,
+    // and get back the endpoint the server knows them by.
+    socket_filepath_ = std::string(static_cast<char*>(reply.data()));
+    if (!use_router_) {
+        (*socket)->connect("ipc://" + socket_filepath_);
+    }
+    connect_latency_.RecordSince(start);
+    return SESSION_OPENED;
+}
+
+NetworkTable::Connection::SessionResult NetworkTable::Connection::Reconnect(\
+        std::unique_ptr<zmq::socket_t> *socket, zmq::socket_t *mt_socket) {
+    // The connect request is answered as soon as the server
+    // is back, however long the attempt waits. Backing off
+    // just saves making new sockets over and over while it's gone.
+    int backoff_millis = kMinReconnectMillis_;
+    while (true) {
+        SessionResult result = OpenSession(socket, mt_socket, backoff_millis);
+        if (result != SESSION_TIMED_OUT) {
+            return result;
+        }
+        backoff_millis = std::min(backoff_millis * 2, kMaxReconnectMillis_);
+    }
+}
+
+void NetworkTable::Connection::SendHeartbeat(zmq::socket_t *socket) {
+    // The server answers an empty GetNodes request with
+    // an empty reply. Nobody waits for it, so it is
+    // dropped once it has been received.
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::GETNODES);
+    request.mutable_getnodes_request();
+    request.set_priority(NetworkTable::Request::HIGH);
+
+    // If the server is gone, the message may have nowhere
+    // to go. Don't wait, the next heartbeat will be sent anyway.
+    zmq::message_t message(request.ByteSizeLong());
+    request.SerializeWithCachedSizesToArray(static_cast<uint8_t*>(message.data()));
+    bytes_sent_ += message.size();
+    socket->send(message, ZMQ_DONTWAIT);
+}
+
+void NetworkTable::Connection::ReplaySubscriptions(zmq::socket_t *socket, zmq::socket_t *fanout_socket, \
+        std::set<std::string> *fanout_uris) {
+    // maps from uri to the fields subscribed to.
+    // Cached uris are subscribed to as whole nodes.
+    std::map<std::string, std::set<std::string>> subscriptions;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        for (const auto &entry : cache_) {
+            subscriptions[entry.first];
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(callbacks_mutex_);
+        for (const auto &entry : callbacks_) {
+            subscriptions[entry.first] = entry.second.fields;
+        }
+
+        // The shared memory may not have opened this time.
+        shared_memory_uris_.clear();
+        for (const auto &entry : subscriptions) {
+            if (notification_ring_.IsOpen() && entry.second.empty() && !use_fanout_) {
+                shared_memory_uris_.insert(entry.first);
+            }
+        }
+    }
+
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::BATCH);
+    for (const auto &entry : subscriptions) {
+        const std::string &uri = entry.first;
+        if (use_fanout_ && entry.second.empty()) {
+            // The fan-out socket subscribes again by itself when
+            // it reconnects, so this is only needed for
+            // subscriptions made before we first connected.
+            if (fanout_uris->insert(uri).second) {
+                std::string topic = uri + '\0';
+                fanout_socket->setsockopt(ZMQ_SUBSCRIBE, topic.data(), topic.size());
+            }
+            continue;
+        }
+
+        auto *batch_request = request.add_batch_requests();
+        batch_request->set_type(NetworkTable::Request::SUBSCRIBE);
+        auto *subscribe_request = batch_request->mutable_subscribe_request();
+        subscribe_request->set_uri(uri);
+        for (const auto &field : entry.second) {
+            subscribe_request->add_fields(field);
+        }
+    }
+
+    // A GetNodes request for each uri, so that one which
+    // doesn't exist yet doesn't fail the rest.
+    int num_subscribes = request.batch_requests_size();
+    std::vector<std::pair<std::string, std::set<std::string>>> refetches;
+    if (refetch_on_reconnect_) {
+        for (const auto &entry : subscriptions) {
+            auto *batch_request = request.add_batch_requests();
+            batch_request->set_type(NetworkTable::Request::GETNODES);
+            batch_request->mutable_getnodes_request()->add_uris(entry.first);
+            refetches.push_back(entry);
+        }
+    }
+
+    if (request.batch_requests_size() == 0) {
+        return;
+    }
+
+    uint64_t id = next_request_id_++;
+    request.set_id(id);
+    request.set_priority(priority_);
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        pending_requests_[id] = [this, num_subscribes, refetches](const NetworkTable::Reply *reply) {
+            // If the server went away again, this
+            // is done again once we reconnect.
+            if (reply == nullptr) {
                 return;
             }
-        } else {
-            // The server replies with a location to connect to.
-            // after this, this ZMQ_REQ socket is no longer needed.
-            if (!init_socket.recv(&reply)) {
-                if (!async) {
-                    std::string request_body = "timeout";
-                    zmq::message_t request(request_body.size()+1);
-                    memcpy(request.data(), request_body.c_str(), request_body.size()+1);
-                    mt_socket.send(request);
+
+            for (int i = 0; i < num_subscribes && i < reply->batch_replies_size(); i++) {
+                if (reply->batch_replies(i).type() == NetworkTable::Reply::ERROR) {
+                    std::cout << "Failed to subscribe again after reconnecting: " \
+                              << reply->batch_replies(i).error_reply().message_data() << std::endl;
                 }
-                return;
             }
-        }
 
-        // Connect to the ZMQ_PAIR socket which was created
-        // by the server.
-        socket_filepath_ = std::string(static_cast<char*>(reply.data()));
-        socket.connect("ipc://" + socket_filepath_);
-        connected_ = true;
+            // Handle each node like an update from the server,
+            // so the cache and callbacks catch up.
+            for (size_t i = 0; i < refetches.size(); i++) {
+                int index = num_subscribes + static_cast<int>(i);
+                if (index >= reply->batch_replies_size() \
+                        || reply->batch_replies(index).type() == NetworkTable::Reply::ERROR) {
+                    continue;
+                }
+
+                const std::string &uri = refetches[i].first;
+                const std::set<std::string> &fields = refetches[i].second;
+                const auto &nodes = reply->batch_replies(index).getnodes_reply().nodes();
+                auto node = nodes.find(uri);
+                if (node == nodes.end()) {
+                    continue;
+                }
+
+                NetworkTable::Reply update;
+                update.set_type(NetworkTable::Reply::SUBSCRIBE);
+                auto *subscribe_reply = update.mutable_subscribe_reply();
+                subscribe_reply->set_uri(uri);
+                if (fields.empty()) {
+                    *subscribe_reply->mutable_node() = node->second;
+                } else {
+                    NetworkTable::Node whole_node = node->second;
+                    *subscribe_reply->mutable_node() = NetworkTable::GetProjectedNode("", fields, &whole_node);
+                }
+                HandleSubscribeReply(update);
+            }
+        };
+    }
+    Send(request, socket);
+}
+
+NetworkTable::LatencyHistogram *NetworkTable::Connection::LatencyFor(NetworkTable::Request::Type type) {
+    switch (type) {
+        case NetworkTable::Request::SETVALUES: return &set_latency_;
+        case NetworkTable::Request::GETNODES: return &get_latency_;
+        case NetworkTable::Request::SUBSCRIBE: return &subscribe_latency_;
+        default: return nullptr;
+    }
+}
+
+void NetworkTable::Connection::ManageSocket(int timeout_millis, bool async) {
+    /*
+     * The context must be created here so that
+     * its destructor is called when this function
+     * ends. For more info see:
+     * http://zeromq.org/whitepapers:0mq-termination
+     */
+    std::unique_ptr<zmq::socket_t> socket;  // Made by OpenSession.
+
+    // Random, so that clients on other hosts
+    // connecting to the same server don't clash.
+    std::random_device random;
+    connection_id_ = (static_cast<uint64_t>(random()) << 32) | random();
+    if (use_router_) {
+        std::ostringstream routing_id;
+        routing_id << std::hex << std::setw(16) << std::setfill('0') << connection_id_;
+        routing_id_ = routing_id.str();
+    }
+
+    // This socket will be used to talk
+    // to the main thread.
+    zmq::socket_t mt_socket(context_, ZMQ_PAIR);
+    mt_socket.connect("inproc://#1");
 
-        // if we're in synchronous mode, we need to tell
-        // the main thread we managed to connected so that it
-        // can move on. If we're not, do not send this message
-        // or it will be received by the main thread
-        // when the main thread expects something completely different.
-        if (!async) {
-            // Let the main thread know we connected
-            std::string request_body = "connected";
-            zmq::message_t request(request_body.size()+1);
-            memcpy(request.data(), request_body.c_str(), request_body.size()+1);
-            mt_socket.send(request);
+    // Only polled if fan-out is enabled. Subscribe replies
+    // published by the server arrive on this socket, filtered
+    // by ZMQ to the uris in fanout_uris.
+    zmq::socket_t fanout_socket(context_, ZMQ_SUB);
+    fanout_socket.setsockopt(ZMQ_LINGER, 0);
+    std::set<std::string> fanout_uris;
+    std::map<std::string, std::vector<uint64_t>> unconfirmed_fanout_uris;
+    if (use_fanout_) {
+        if (reconnect_) {
+            fanout_socket.setsockopt(ZMQ_RECONNECT_IVL, kMinReconnectMillis_);
+        }
+        if (!tcp_host_.empty()) {
+            fanout_socket.connect("tcp://" + tcp_host_ + ":" + std::to_string(tcp_port_ + 1));
+        } else {
+            fanout_socket.connect("ipc://" + kWelcome_Directory_ + "NetworkTableFanout");
         }
     }
 
-    // Poll the two sockets.
+    // Connect to the server.
+    // In synchronous mode, we wait some time for the server
+    // to reply, and then possibly timeout.
+    // In async mode, we wait forever to the server to
+    // reply. It might not even be up yet. However,
+    // the main thread is not blocked, and continuous on
+    // while we wait to connect to the server here.
+    SessionResult result = OpenSession(&socket, &mt_socket, async ? -1 : timeout_millis);
+    if (result == SESSION_TIMED_OUT && !async) {
+        std::string request_body = "timeout";
+        zmq::message_t request(request_body.size()+1);
+        memcpy(request.data(), request_body.c_str(), request_body.size()+1);
+        mt_socket.send(request);
+    }
+    if (result != SESSION_OPENED) {
+        return;
+    }
+    connected_ = true;
+
+    // Before anything which runs callbacks starts.
+    callback_executor_.Start(callback_threads_);
+
+    StartReadingSharedMemory();
+
+    // Subscriptions made before we connected, if reconnect is enabled.
+    ReplaySubscriptions(socket.get(), &fanout_socket, &fanout_uris);
+
+    // if we're in synchronous mode, we need to tell
+    // the main thread we managed to connected so that it
+    // can move on. If we're not, do not send this message
+    // or it will be received by the main thread
+    // when the main thread expects something completely different.
+    if (!async) {
+        // Let the main thread know we connected
+        std::string request_body = "connected";
+        zmq::message_t request(request_body.size()+1);
+        memcpy(request.data(), request_body.c_str(), request_body.size()+1);
+        mt_socket.send(request);
+    }
+
+    // Poll the sockets.
     std::vector<zmq::pollitem_t> pollitems;
 
     zmq::pollitem_t pollitem;
-    pollitem.socket = static_cast<void*>(socket);
+    pollitem.socket = static_cast<void*>(*socket);
     pollitem.events = ZMQ_POLLIN;
     pollitems.push_back(pollitem);
 
@@ -489,91 +1888,228 @@ void NetworkTable::Connection::ManageSocket(int timeout_millis, bool async) {
     mt_pollitem.events = ZMQ_POLLIN;
     pollitems.push_back(mt_pollitem);
 
-    // Used to avoid stale replies
-    // ie (client times out then server replies)
-    std::string current_request_id = "";
+    // Requests from the main thread. This is a plain
+    // file descriptor, rather than a socket.
+    zmq::pollitem_t queue_pollitem;
+    queue_pollitem.socket = nullptr;
+    queue_pollitem.fd = request_queue_.fd();
+    queue_pollitem.events = ZMQ_POLLIN;
+    pollitems.push_back(queue_pollitem);
+
+    if (use_fanout_) {
+        zmq::pollitem_t fanout_pollitem;
+        fanout_pollitem.socket = static_cast<void*>(fanout_socket);
+        fanout_pollitem.events = ZMQ_POLLIN;
+        pollitems.push_back(fanout_pollitem);
+    }
+
+    // Replies received on this thread are parsed onto
+    // the arena, and freed all at once after each poll.
+    std::unique_ptr<char[]> arena_block(new char[kArenaBlockSize_]);
+    google::protobuf::Arena arena(ArenaOptionsWithBlock(arena_block.get(), kArenaBlockSize_));
+
+    // With the write buffer enabled, wake up
+    // every so often to send what's in it.
+    auto next_flush = std::chrono::steady_clock::now() + \
+        std::chrono::milliseconds(write_buffer_interval_millis_);
+
+    // With reconnect enabled, when we last heard from the
+    // server, and when we last sent it a heartbeat.
+    auto last_received = std::chrono::steady_clock::now();
+    auto last_heartbeat = last_received;
+
+    // With the stats dump enabled, when to next print them.
+    auto next_stats_dump = std::chrono::steady_clock::now() + \
+        std::chrono::milliseconds(stats_dump_interval_millis_);
 
     while (true) {
-        zmq::poll(pollitems.data(), 2, -1);
+        // Sleep until the next thing which is due,
+        // or until a message arrives.
+        auto now = std::chrono::steady_clock::now();
+        auto wake_up = std::chrono::steady_clock::time_point::max();
+        if (write_buffer_interval_millis_ > 0) {
+            wake_up = std::min(wake_up, next_flush);
+        }
+        if (reconnect_) {
+            // In time to send the next heartbeat,
+            // or to notice that the server is gone.
+            wake_up = std::min(wake_up, \
+                std::max(last_received, last_heartbeat) + std::chrono::milliseconds(kHeartbeatIntervalMillis_));
+            wake_up = std::min(wake_up, last_received + std::chrono::milliseconds(kHeartbeatTimeoutMillis_));
+        }
+        if (stats_dump_interval_millis_ > 0) {
+            wake_up = std::min(wake_up, next_stats_dump);
+        }
+        long timeout_millis = -1;  // NOLINT(runtime/int)
+        if (wake_up != std::chrono::steady_clock::time_point::max()) {
+            timeout_millis = std::max(0L, static_cast<long>(\
+                std::chrono::duration_cast<std::chrono::milliseconds>(\
+                    wake_up - now).count()));  // NOLINT(runtime/int)
+        }
+        zmq::poll(pollitems.data(), pollitems.size(), timeout_millis);
+        arena.Reset();
+
+        // Anything from the server shows that it's still there,
+        // not just replies on our own socket. A busy server may
+        // be slow to answer heartbeats while it keeps publishing.
+        if ((pollitems[0].revents & ZMQ_POLLIN) \
+                || (use_fanout_ && (pollitems[3].revents & ZMQ_POLLIN))) {
+            last_received = std::chrono::steady_clock::now();
+        }
+        last_received = std::max(last_received, std::chrono::steady_clock::time_point(\
+            std::chrono::steady_clock::duration(last_shared_memory_message_)));
+
+        if (write_buffer_interval_millis_ > 0 && std::chrono::steady_clock::now() >= next_flush) {
+            FlushWriteBuffer(socket.get());
+            next_flush = std::chrono::steady_clock::now() + \
+                std::chrono::milliseconds(write_buffer_interval_millis_);
+        }
+
+        if (stats_dump_interval_millis_ > 0 && std::chrono::steady_clock::now() >= next_stats_dump) {
+            PrintStats(GetStats());
+            next_stats_dump = std::chrono::steady_clock::now() + \
+                std::chrono::milliseconds(stats_dump_interval_millis_);
+        }
 
         // If message from network table server
         if (pollitems[0].revents & ZMQ_POLLIN) {
-            NetworkTable::Reply reply;
-            Receive(&reply, &socket);
+            NetworkTable::Reply &reply = \
+                *google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(&arena);
+            Receive(&reply, socket.get());
             // If it's a subscribe reply,
             // just run the associated callback function.
             if (reply.type() == NetworkTable::Reply::SUBSCRIBE \
                     && reply.has_subscribe_reply()) {
-                std::string uri = reply.subscribe_reply().uri();
-                NetworkTable::Node node = reply.subscribe_reply().node();
-
-                bool is_self_reply = \
-                  reply.subscribe_reply().responsible_socket() == socket_filepath_;
+                HandleSubscribeReply(reply);
+            } else {
+                // Replies are matched to requests by id.
+                // Ones nobody is waiting for any more
+                // are just discarded.
+                DeliverReply(reply);
+            }
+        }
 
-                std::map<std::string, NetworkTable::Value> diffs;
-                for (const auto &diff : reply.subscribe_reply().diffs()) {
-                    diffs[diff.first] = diff.second;
+        if (reconnect_) {
+            now = std::chrono::steady_clock::now();
+            if (now - last_received >= std::chrono::milliseconds(kHeartbeatTimeoutMillis_)) {
+                std::cout << "Lost the network table server, reconnecting" << std::endl;
+
+                // The old session's replies aren't coming. New requests
+                // stay queued until the new session is open.
+                StopReadingSharedMemory();
+                FailPendingRequests();
+                if (!use_router_) {
+                    remove(socket_filepath_.c_str());
                 }
 
-                // Even after sending an Unsubscribe request,
-                // it can take a while for that request to be processed
-                // if other processes are also sending requests to the server.
-                // If one of these other requests happens to update
-                // a value which was subscribed to by this process,
-                // a SubscribeReply can still be sent by the server,
-                // even though this process just sent an UnsubscribeRequest
-                // to the server.
-                if (callbacks_[uri] != NULL) {
-                    callbacks_[uri](node, diffs, is_self_reply);
+                result = Reconnect(&socket, &mt_socket);
+                if (result == SESSION_INTERRUPTED) {
+                    connected_ = false;
+                    callback_executor_.Stop();
+                    DropQueuedRequests();
+                    FailPendingRequests();
+                    return;
                 }
-            } else {
-                if (reply.id() == current_request_id) {
-                    Send(reply, &mt_socket);
-                    current_request_id = "";
+                if (result == SESSION_DISCONNECTED) {
+                    break;
                 }
-                // If the reply id is incorrect,
-                // its should just be an old reply
-                // which we can discard.
+
+                std::cout << "Reconnected to the network table server" << std::endl;
+                pollitems[0].socket = static_cast<void*>(*socket);
+                StartReadingSharedMemory();
+                ReplaySubscriptions(socket.get(), &fanout_socket, &fanout_uris);
+                last_received = std::chrono::steady_clock::now();
+                last_heartbeat = last_received;
+                continue;
             }
+
+            if (now - std::max(last_received, last_heartbeat) \
+                    >= std::chrono::milliseconds(kHeartbeatIntervalMillis_)) {
+                SendHeartbeat(socket.get());
+                last_heartbeat = now;
+            }
+        }
+
+        // If requests from the main thread
+        if (pollitems[2].revents & ZMQ_POLLIN) {
+            SendQueuedRequests(socket.get(), &fanout_socket, &fanout_uris, &unconfirmed_fanout_uris);
         }
 
-        // If request from main thread
+        // If message from main thread
         if (pollitems[1].revents & ZMQ_POLLIN) {
             zmq::message_t message;
             mt_socket.recv(&message);
 
-            /*
-             * This looks jank (convert c string to std::string and then back),
-             * but for some reason I had to do this (can't remember why. maybe you can fix it?)
-             */
-            std::string message_data(static_cast<char*>(message.data()), message.size());
-            if (strcmp(message_data.c_str(), "disconnect") == 0) {
+            if (MessageIs(message, "disconnect")) {
+                // Don't lose anything queued or buffered.
+                SendQueuedRequests(socket.get(), &fanout_socket, &fanout_uris, &unconfirmed_fanout_uris);
+                FlushWriteBuffer(socket.get());
                 break;
             }
 
-            if (strcmp(message_data.c_str(), "interrupted") == 0) {
+            if (MessageIs(message, "flush")) {
+                FlushWriteBuffer(socket.get());
+                continue;
+            }
+
+            if (MessageIs(message, "interrupted")) {
+                connected_ = false;
+                StopReadingSharedMemory();
+                callback_executor_.Stop();
+                DropQueuedRequests();
+                FailPendingRequests();
                 return;
             }
+        }
 
-            NetworkTable::Request request;
-            request.ParseFromString(message_data);
-            current_request_id = boost::uuids::to_string(\
-                        boost::uuids::random_generator()());
-            request.set_id(current_request_id);
-            Send(request, &socket);
+        // If subscribe reply from the fan-out socket.
+        // The first frame is the topic, which is uri + '\0'.
+        if (use_fanout_ && (pollitems[3].revents & ZMQ_POLLIN)) {
+            zmq::message_t topic;
+            fanout_socket.recv(&topic);
+            zmq::message_t message;
+            fanout_socket.recv(&message);
+            bytes_received_ += message.size();
+
+            // An empty message means the server has seen a
+            // subscription to this topic. It might not be ours,
+            // in which case there's nothing to confirm.
+            if (message.size() == 0 && topic.size() > 0) {
+                std::string uri(static_cast<char*>(topic.data()), topic.size() - 1);
+                ConfirmFanoutSubscription(uri, &unconfirmed_fanout_uris);
+            } else {
+                NetworkTable::Reply &reply = \
+                    *google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(&arena);
+                reply.ParseFromArray(message.data(), message.size());
+                if (reply.type() == NetworkTable::Reply::SUBSCRIBE \
+                        && reply.has_subscribe_reply()) {
+                    HandleSubscribeReply(reply);
+                }
+            }
         }
     }
 
+    connected_ = false;
+    StopReadingSharedMemory();
+    callback_executor_.Stop();
+    DropQueuedRequests();
+    FailPendingRequests();
+
     {
-        // Disconnect from server.
+        // Disconnect from server. The socket is closed
+        // as soon as we return, so give it some time to
+        // deliver this instead of dropping it.
         std::string request_body = "disconnect";
         zmq::message_t request(request_body.size()+1);
         memcpy(request.data(), request_body.c_str(), request_body.size()+1);
-        socket.send(request);
+        socket->setsockopt(ZMQ_LINGER, kDisconnectLingerMillis_);
+        socket->send(request, ZMQ_DONTWAIT);
 
         // Delete the socket ourselves, in case the server
         // is down and doesnt receive our disconnect request.
-        remove(socket_filepath_.c_str());
+        if (!use_router_) {
+            remove(socket_filepath_.c_str());
+        }
         socket_filepath_ = "";
     }
 }
@@ -3,28 +3,133 @@
 #ifndef CONNECTION_H_
 #define CONNECTION_H_
 
+#include "CallbackExecutor.h"
+#include "LatencyHistogram.h"
+#include "ModifyValueRequest.pb.h"
 #include "Reply.pb.h"
 #include "Request.pb.h"
+#include "RequestQueue.h"
 #include "Node.pb.h"
+#include "SharedMemoryRing.h"
 #include "Value.pb.h"
+#include "ValueTraits.h"
 
 #include <atomic>
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/nil_generator.hpp>
-#include <boost/uuid/random_generator.hpp>
+#include <chrono>
 #include <exception>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <queue>
+#include <type_traits>
 #include <utility>
+#include <vector>
 #include <zmq.hpp>
 
 namespace NetworkTable {
+/*
+ * Run with the new node when a subscribed uri changes
+ * (see Connection::Subscribe). This can be a plain function,
+ * or a lambda which captures state.
+ */
+typedef std::function<void(NetworkTable::Node node,
+        const std::map<std::string, NetworkTable::Value> &diffs,
+        bool is_self_reply)> SubscribeCallback;
+
+/*
+ * Requests which are sent to the server in a single message,
+ * and handled by it in the order they were added.
+ * Use this to avoid a round trip per request, eg. when
+ * subscribing to many uris at startup. See Connection::SendBatch.
+ */
+class Batch {
+ public:
+    void SetValue(const std::string &uri, const NetworkTable::Value &value);
+
+    void SetValues(const std::map<std::string, NetworkTable::Value> &values);
+
+    /*
+     * The nodes are returned by SendBatch.
+     */
+    void GetNodes(const std::set<std::string> &uris);
+
+    /*
+     * Same as Connection::Subscribe, except that it always goes
+     * through the server, even if fan-out is enabled.
+     */
+    void Subscribe(const std::string &uri, const NetworkTable::SubscribeCallback &callback, \
+            const std::set<std::string> &fields = {});
+
+    /*
+     * Same as Connection::Unsubscribe. If uri is cached,
+     * only the callback is removed, and the server keeps
+     * sending the updates the cache needs.
+     */
+    void Unsubscribe(const std::string &uri);
+
+ private:
+    friend class Connection;
+
+    NetworkTable::Request request_;
+    std::vector<NetworkTable::SubscribeCallback> callbacks_;  // One for each subscribe request, in order.
+};
+
+/*
+ * A node read from the local cache (see Connection::Cache),
+ * and how fresh it is.
+ */
+struct CachedNode {
+    NetworkTable::Node node;
+    uint64_t version;  // Counts the updates received for the cached uri.
+    std::chrono::steady_clock::time_point updated;  // When the last update arrived.
+};
+
+/*
+ * How a connection has been doing since it connected
+ * (see Connection::GetStats). Request times are from being
+ * queued to the reply arriving, and include time spent
+ * waiting behind other requests.
+ */
+struct ConnectionStats {
+    NetworkTable::LatencyStats connect;  // Opening a session with the server, including reconnects.
+    NetworkTable::LatencyStats set;  // SetValues requests, including write buffer flushes.
+    NetworkTable::LatencyStats get;  // GetNodes requests which weren't answered from the cache.
+    NetworkTable::LatencyStats subscribe;
+    NetworkTable::LatencyStats callback_dispatch;  // From an update arriving to its callback starting.
+    NetworkTable::LatencyStats callback_run;  // How long callbacks took.
+    NetworkTable::LatencyStats queue_wait;  // From a request being queued to being sent.
+    uint64_t timeouts;  // Requests given up on (see TimeoutException).
+    uint64_t stale_replies;  // Replies which arrived after their request was given up on.
+    uint64_t bytes_sent;
+    uint64_t bytes_received;  // Including subscribe replies from fan-out and shared memory.
+    size_t callback_queue_depth;  // See Connection::CallbackQueueDepth.
+    size_t max_callback_queue_depth;
+};
+
+/*
+ * A session with the network table server.
+ * Once connected, any number of threads can use the same
+ * connection at once. Their requests share the connection's
+ * socket, and each reply goes back to whoever sent the request.
+ * Connect, and the functions which must be called before it,
+ * should only be called by one thread.
+ */
 class Connection {
  public:
-    Connection();
+    /*
+     * @param directory - where the server's sockets are, see Server().
+     * @param shared_memory_name - the shared memory which the server
+     *                             writes subscribe replies to, see
+     *                             EnableSharedMemory.
+     */
+    explicit Connection(const std::string &directory = "/tmp/sailbot/", \
+            const std::string &shared_memory_name = "/sailbot_network_table");
 
     /*
      * Open a connection to the network table. After this,
@@ -40,6 +145,135 @@ class Connection {
 
     void Disconnect();
 
+    /*
+     * Receive subscribe replies through the server's fan-out
+     * socket instead of this connection's own socket.
+     * The server then sends each update once to every fan-out
+     * subscriber of a uri, instead of once per subscriber.
+     * Subscriptions with fields (see Subscribe) still go
+     * through this connection's own socket.
+     * Subscribe still returns only once the server's fan-out
+     * socket has seen the subscription, so no later update
+     * is missed.
+     * Must be called before Connect.
+     */
+    void EnableFanout();
+
+    /*
+     * Read subscribe replies from shared memory instead of
+     * this connection's own socket. This only works if the
+     * server is on the same host; if the shared memory can't
+     * be opened, the socket is used like normal.
+     * Fan-out (see EnableFanout) takes precedence for
+     * subscriptions which can use it.
+     * Must be called before Connect.
+     */
+    void EnableSharedMemory();
+
+    /*
+     * Connect through the server's single ZMQ_ROUTER socket,
+     * instead of asking it to create a ZMQ_PAIR socket for us.
+     * Connecting takes one round trip, and nothing is left
+     * behind on disk if this process crashes.
+     * Must be called before Connect.
+     */
+    void EnableRouter();
+
+    /*
+     * Connect to a server on another host, over TCP.
+     * The server must have been started with that port
+     * (see Server::ListenOnTcp). This uses the router
+     * connection mode, and fan-out (if enabled) connects
+     * to port + 1. Shared memory is never used.
+     * Must be called before Connect.
+     */
+    void EnableTcp(const std::string &host, int port);
+
+    /*
+     * Notice when the server goes away, and reconnect to it.
+     * After a second without hearing from the server, a heartbeat
+     * is sent; after kHeartbeatTimeoutMillis_ without hearing anything
+     * (replies, or fan-out and shared memory updates), the
+     * server is taken to be gone. Requests waiting for a reply then
+     * fail with NotConnectedException, and new ones are held until
+     * connecting again succeeds. Each attempt waits twice as long
+     * as the last (from kMinReconnectMillis_ up to kMaxReconnectMillis_),
+     * and succeeds as soon as the server is back.
+     * Subscriptions and cached uris are sent to the server again once
+     * reconnected, as are ones made after an async Connect but before
+     * the server was reached.
+     * @param refetch - also get each subscribed node from the server
+     *                  once reconnected, and run its callback with it
+     *                  (with no diffs), so that changes made while
+     *                  disconnected aren't missed.
+     * Must be called before Connect.
+     */
+    void EnableReconnect(bool refetch = false);
+
+    /*
+     * Set the priority of every request sent after this.
+     * The server handles HIGH priority requests (eg. actuation
+     * angles) before normal ones which arrived at the same time,
+     * such as bulk sensor writes. Requests from this connection
+     * are still handled in the order they were sent, so raising
+     * the priority never reorders its own writes.
+     */
+    void SetPriority(NetworkTable::Request::Priority priority);
+
+    /*
+     * Run subscription callbacks on their own threads, instead of
+     * on the thread which receives replies from the server. Then
+     * a slow callback (eg. one doing a CAN write) doesn't hold up
+     * other replies, acks and callbacks.
+     * With 1 thread, callbacks run one at a time in order. With
+     * more, callbacks for the same uri still run in order, but ones
+     * for different uris can run at the same time.
+     * 0 (the default) runs them inline, in which case they must
+     * not block, or make blocking calls on this connection.
+     * Callbacks still queued when disconnecting are dropped.
+     * Must be called before Connect.
+     */
+    void SetCallbackThreads(int num_threads);
+
+    /*
+     * Number of callbacks waiting for a callback thread, and the
+     * most there have been since connecting. A growing queue means
+     * callbacks can't keep up with updates.
+     */
+    size_t CallbackQueueDepth() const;
+    size_t MaxCallbackQueueDepth() const;
+
+    /*
+     * Timings and counts for this connection since
+     * it connected. Can be called from any thread.
+     */
+    NetworkTable::ConnectionStats GetStats() const;
+
+    /*
+     * Print GetStats every interval_millis while connected,
+     * eg. to find out why a listener is lagging.
+     * Must be called before Connect.
+     */
+    void EnableStatsDump(int interval_millis);
+
+    /*
+     * Buffer the values given to SetValue and SetValues instead
+     * of sending a request for each call. Values for the same uri
+     * are merged (the latest wins), and sent as a single request
+     * every flush_interval_millis, as soon as max_values uris are
+     * buffered, or on Flush. SetValue and SetValues then return
+     * without waiting for the server, and errors are printed.
+     * Gets don't see buffered values until they are sent.
+     * Must be called before Connect.
+     */
+    void EnableWriteBuffer(int flush_interval_millis, size_t max_values = 64);
+
+    /*
+     * Sends any buffered values (see EnableWriteBuffer)
+     * and waits for the server to ack them.
+     */
+    void Flush();
+
     /*
      * Set value in the network table, or create
      * it if it doesn't exist.
@@ -55,11 +289,104 @@ class Connection {
      */
     void SetValues(const std::map<std::string, NetworkTable::Value> &values);
 
+    /*
+     * Sets uri to value, which can be an int, float, double (stored
+     * as a float), bool or string. The Value type is picked at compile
+     * time (see ValueTraits.h), and value is written straight into
+     * the request. Otherwise the same as SetValue.
+     */
+    template <typename T>
+    void Set(const std::string &uri, const T &value);
+
+    /*
+     * Same as above, for each uri/value pair in values, in one request.
+     */
+    template <typename T>
+    void Set(const std::map<std::string, T> &values);
+
+    /*
+     * Sets values of different types in one request,
+     * eg. SetMany(std::make_pair("gps_0/gprmc/latitude", 49.26),
+     *             std::make_pair("gps_0/gpgga/quality_indicator", 1)).
+     */
+    template <typename... Pairs>
+    void SetMany(const Pairs &... uri_values);
+
+    /*
+     * Like SetValues, but returns without waiting for the server.
+     * Any number of these can be in flight at once, and the server
+     * applies them in the order they were sent.
+     * @return - becomes ready when the server acks the request.
+     *           get() throws whatever SetValues would have.
+     *           There is no timeout, use wait_for to give up early.
+     */
+    std::future<void> SetValuesAsync(const std::map<std::string, NetworkTable::Value> &values);
+    std::future<void> SetValueAsync(const std::string &uri, const NetworkTable::Value &value);
+
+    /*
+     * Same as above, but on_done is called once the server acks
+     * the request, with a null error if it succeeded.
+     * The *Async functions taking a callback all call it from
+     * this connection's background thread, so it must not block,
+     * or make blocking calls on this connection.
+     */
+    void SetValuesAsync(const std::map<std::string, NetworkTable::Value> &values, \
+            std::function<void(std::exception_ptr error)> on_done);
+
+    /*
+     * Sets values without the server acking them, for streams
+     * of readings where each one overwrites the last (eg. wind
+     * sensor frames). Never blocks: if the write can't be queued
+     * right away, it is dropped. Writes are numbered, so the server
+     * can tell (and logs) when some of them were lost.
+     * @return - false if the write was dropped.
+     */
+    bool Publish(const std::string &uri, const NetworkTable::Value &value);
+    bool Publish(const std::map<std::string, NetworkTable::Value> &values);
+
+    /*
+     * Sets uri to value, but only if it is currently expected.
+     * The server checks and sets it in one go, so nobody
+     * else can change it in between.
+     * @return - true if it was set.
+     */
+    bool CompareAndSet(const std::string &uri, const NetworkTable::Value &expected, \
+            const NetworkTable::Value &value);
+
+    /*
+     * Sets uri to value, but only if it doesn't have a value yet.
+     * @return - true if it was set.
+     */
+    bool SetIfMissing(const std::string &uri, const NetworkTable::Value &value);
+
+    /*
+     * Adds amount (an int or float) to the number at uri,
+     * or sets it to amount if it doesn't exist.
+     * @return - the new value.
+     * @throws - std::runtime_error if uri or amount isn't a number.
+     */
+    NetworkTable::Value Increment(const std::string &uri, const NetworkTable::Value &amount);
+
+    /*
+     * Adds items to the end of the string, bytes, waypoints or
+     * boats at uri, or sets it to items if it doesn't exist.
+     * @return - the new value.
+     * @throws - std::runtime_error if uri holds a different type.
+     */
+    NetworkTable::Value Append(const std::string &uri, const NetworkTable::Value &items);
+
     /*
      * Get value from the network table.
      */
     NetworkTable::Value GetValue(const std::string &uri);
 
+    /*
+     * Gets the value at uri as a T (see Set).
+     * @throws - std::runtime_error if it isn't stored as a T.
+     */
+    template <typename T>
+    T Get(const std::string &uri);
+
     /*
      * Get multiple values from the network table.
      * The values are returned in the same order that
@@ -84,6 +411,22 @@ class Connection {
      */
     std::map<std::string, NetworkTable::Node> GetNodes(const std::set<std::string> &uris);
 
+    /*
+     * Like GetNodes, but returns without waiting for the server.
+     * @return - becomes ready when the nodes arrive.
+     *           get() throws whatever GetNodes would have.
+     */
+    std::future<std::map<std::string, NetworkTable::Node>> GetNodesAsync(const std::set<std::string> &uris);
+
+    /*
+     * Same as above, but on_done is called with the nodes once
+     * they arrive, or with the error if it failed
+     * (see SetValuesAsync for where it is called from).
+     */
+    void GetNodesAsync(const std::set<std::string> &uris, \
+            std::function<void(std::exception_ptr error, \
+                const std::map<std::string, NetworkTable::Node> &nodes)> on_done);
+
     /*
      * Begin receiving updates on a uri in
      * the network table. The callback function is
@@ -96,11 +439,22 @@ class Connection {
      *                   by this connection. Ie, if you send a SetValues request,
      *                   and you are subscribed to the root node "/", you will be 
      *                   able to tell that it was you who caused this subscribe request.
+     * @param fields - (optional) paths relative to uri. If any are given,
+     *                 the node passed to callback only contains these descendants,
+     *                 and the callback only runs when one of them changes.
+     *                 eg. uri "/" with fields {"gps_0/gprmc", "wind_sensor_0"}.
+     */
+    void Subscribe(std::string uri, const NetworkTable::SubscribeCallback &callback, \
+            const std::set<std::string> &fields = {});
+
+    /*
+     * Like Subscribe, but returns without waiting for the server.
+     * The callback starts running once the server acks the request.
+     * @return - becomes ready when the server acks the request.
      */
-    void Subscribe(std::string uri, \
-            void (*callback)(NetworkTable::Node node,
-                const std::map<std::string, NetworkTable::Value> &diffs,
-                bool is_self_reply));
+    std::future<void> SubscribeAsync(const std::string &uri, \
+            const NetworkTable::SubscribeCallback &callback, \
+            const std::set<std::string> &fields = {});
 
     /*
      * Stop receiving updates on a uri in the network table.
@@ -108,7 +462,83 @@ class Connection {
      */
     void Unsubscribe(std::string uri);
 
+    /*
+     * Like Unsubscribe, but returns without waiting for the server.
+     * The callback stops running right away.
+     * @return - becomes ready when the server acks the request.
+     */
+    std::future<void> UnsubscribeAsync(const std::string &uri);
+
+    /*
+     * Sends every request in the batch to the server at once,
+     * and waits for the server to handle all of them.
+     * Subscribers are sent the values set by the batch
+     * after the whole batch is done.
+     * @return - the nodes for each GetNodes in the batch, in order.
+     * @throws - the error for the first request in the batch which failed
+     *           (see CheckForError), eg. NodeNotFoundException for a GetNodes.
+     *           The rest of the batch is still done.
+     */
+    std::vector<std::map<std::string, NetworkTable::Node>> SendBatch(const NetworkTable::Batch &batch);
+
+    /*
+     * Keep a copy of the node at uri, and everything under it,
+     * in this process. The copy is kept up to date by subscribing
+     * to uri, so GetValue, GetValues, GetNode and GetNodes for uri
+     * and its descendants are answered without asking the server.
+     * Updates arrive in the background, so a cached read can be
+     * a little behind the server (see GetCachedNode).
+     * You can still Subscribe to uri yourself, but not with fields.
+     * The cache is emptied on Disconnect.
+     */
+    void Cache(const std::string &uri);
+
+    /*
+     * Stop caching uri. Has no effect if it isn't cached.
+     */
+    void Uncache(const std::string &uri);
+
+    /*
+     * Reads the node at uri from the cache, along with
+     * the version and arrival time of the update it came from.
+     * @return - false if uri isn't cached (see Cache).
+     * @throws - NodeNotFoundException if uri is cached but doesn't exist.
+     */
+    bool GetCachedNode(const std::string &uri, NetworkTable::CachedNode *cached_node);
+
  private:
+    /*
+     * A serialized request waiting for the manage socket thread
+     * to send it. If fan-out is enabled, subscribe and unsubscribe
+     * requests keep a copy of the request, so the manage socket
+     * thread can handle them itself without parsing message.
+     */
+    struct QueuedRequest {
+        zmq::message_t message;
+        std::shared_ptr<NetworkTable::Request> subscription;
+        std::chrono::steady_clock::time_point queued;  // For GetStats.
+    };
+
+    /*
+     * A callback, and the fields it was subscribed with
+     * (empty for the whole node), so that the subscription
+     * can be made again after reconnecting.
+     */
+    struct Subscription {
+        NetworkTable::SubscribeCallback callback;
+        std::set<std::string> fields;
+    };
+
+    /*
+     * How an attempt to open a session with the server ended.
+     */
+    enum SessionResult {
+        SESSION_OPENED,
+        SESSION_TIMED_OUT,
+        SESSION_DISCONNECTED,  // Disconnect was called while waiting.
+        SESSION_INTERRUPTED
+    };
+
     int Send(const NetworkTable::Request &request, zmq::socket_t *socket);
 
     int Send(const NetworkTable::Reply &reply, zmq::socket_t *socket);
@@ -117,9 +547,167 @@ class Connection {
 
     int Receive(NetworkTable::Request *request, zmq::socket_t *socket);
 
+    /*
+     * Sends a SetValues request made by Set or SetMany, and waits
+     * for the ack. If the write buffer is enabled, the values
+     * are buffered instead.
+     */
+    void SendSetValues(NetworkTable::Request *request);
+
+    /*
+     * Adds each uri/value pair to values, for SetMany.
+     */
+    static void AddValues(google::protobuf::Map<std::string, NetworkTable::Value> *) {}
+
+    template <typename Uri, typename T, typename... Pairs>
+    static void AddValues(google::protobuf::Map<std::string, NetworkTable::Value> *values, \
+            const std::pair<Uri, T> &uri_value, const Pairs &... rest);
+
+    /*
+     * Sends a compare and set, increment or append,
+     * and waits for the result.
+     * @throws - std::runtime_error if the server couldn't do it.
+     */
+    NetworkTable::ModifyValueReply ModifyValue(const NetworkTable::ModifyValueRequest &modifyvalue_request);
+
+    /*
+     * Registers the callback for a uri once the server has acked the
+     * subscription. fields is empty unless only some fields were
+     * subscribed to. via_fanout is true if it was subscribed
+     * to through the fan-out socket instead of the server.
+     */
+    void AddCallback(const std::string &uri, const NetworkTable::SubscribeCallback &callback, \
+            const std::set<std::string> &fields, bool via_fanout);
+
+    /*
+     * With reconnect enabled, registers the callback for a uri if
+     * the manage socket thread hasn't reached the server yet. It
+     * subscribes to it once it does (see ReplaySubscriptions).
+     * @return - false if already connected, in which case
+     *           the caller must subscribe like normal.
+     */
+    bool AddCallbackBeforeConnected(const std::string &uri, \
+            const NetworkTable::SubscribeCallback &callback, const std::set<std::string> &fields);
+
+    /*
+     * Updates the cache, and runs the callback,
+     * for the uri in a subscribe reply.
+     */
+    void HandleSubscribeReply(const NetworkTable::Reply &reply);
+
+    /*
+     * Moves every uri in uris which is cached into nodes.
+     */
+    void GetCachedNodes(std::set<std::string> *uris, std::map<std::string, NetworkTable::Node> *nodes);
+
+    /*
+     * Same as above, but only copies the values.
+     */
+    void GetCachedValues(std::set<std::string> *uris, std::map<std::string, NetworkTable::Value> *values);
+
+    /*
+     * Runs in its own thread while connected with shared memory enabled.
+     * Reads subscribe replies from shared memory and runs their callbacks.
+     */
+    void ReadSharedMemory();
+
+    /*
+     * Starts a thread running ReadSharedMemory, if the shared memory is open.
+     */
+    void StartReadingSharedMemory();
+
+    /*
+     * Stops and joins the thread running ReadSharedMemory, if any.
+     */
+    void StopReadingSharedMemory();
+
+    /*
+     * Serializes request and puts it on request_queue_,
+     * for the manage socket thread to send.
+     */
+    void QueueRequest(const NetworkTable::Request &request);
+
+    /*
+     * Sends everything on request_queue_ to the server, or handles it
+     * with the fan-out socket. Only called by the manage socket thread.
+     */
+    void SendQueuedRequests(zmq::socket_t *socket, zmq::socket_t *fanout_socket, \
+            std::set<std::string> *fanout_uris, \
+            std::map<std::string, std::vector<uint64_t>> *unconfirmed_fanout_uris);
+
+    /*
+     * Acks the fan-out subscribe requests waiting on uri, once
+     * the server has seen the subscription (or it was dropped).
+     * Only called by the manage socket thread.
+     */
+    void ConfirmFanoutSubscription(const std::string &uri, \
+            std::map<std::string, std::vector<uint64_t>> *unconfirmed_fanout_uris);
+
+    /*
+     * Throws away everything on request_queue_, so that it
+     * isn't sent if we connect again. Their pending requests
+     * are failed by FailPendingRequests.
+     */
+    void DropQueuedRequests();
+
+    /*
+     * Gives request the next id, and hands it to the manage socket thread
+     * to send. on_reply is called by the manage socket thread when
+     * the reply (or ack) with that id comes back, or with nullptr if
+     * the connection closes first. Doesn't wait for the reply, so
+     * any number of requests can be in flight at once.
+     */
+    void SendRequest(NetworkTable::Request *request, \
+            std::function<void(const NetworkTable::Reply *reply)> on_reply);
+
+    /*
+     * Same as above, but the reply is delivered through a future.
+     */
+    std::future<NetworkTable::Reply> SendRequest(NetworkTable::Request *request);
+
+    /*
+     * Same as above, but on_done is given the exception that
+     * waiting for the reply would have thrown (see CheckForError),
+     * or a null error and the reply.
+     */
+    void SendRequestAsync(NetworkTable::Request *request, \
+            std::function<void(std::exception_ptr error, const NetworkTable::Reply *reply)> on_done);
+
+    /*
+     * Sends request, returning a future which becomes
+     * ready when the server acks it.
+     */
+    std::future<void> SendRequestForAck(NetworkTable::Request *request);
+
+    /*
+     * Waits up to the timeout given to Connect for the reply
+     * to the request with the given id.
+     * @throws - TimeoutException, InterruptedException, or any
+     *           error from the server (see CheckForError).
+     */
+    NetworkTable::Reply WaitForReply(uint64_t id, std::future<NetworkTable::Reply> *reply);
+
+    /*
+     * Runs (and forgets) the on_reply for the request with the same id
+     * as reply. Replies for requests we gave up on are dropped.
+     */
+    void DeliverReply(const NetworkTable::Reply &reply);
+
+    /*
+     * Tells everyone still waiting on a reply that it isn't coming.
+     */
+    void FailPendingRequests();
+
+    /*
+     * Makes an ack reply with the given id.
+     */
+    NetworkTable::Reply MakeAck(uint64_t id);
+
     /*
      * Checks to see if reply is an error message and
-     * throws appropriate exception if it is.
+     * throws appropriate exception if it is:
+     * NodeNotFoundException for NODE_NOT_FOUND,
+     * std::runtime_error for anything else.
      */
     void CheckForError(const NetworkTable::Reply &reply);
 
@@ -127,7 +715,7 @@ class Connection {
      * Waits to receive an ACK message from the server.
      * Throws timeout if takes too long.
      */
-    void WaitForAck();
+    void WaitForAck(uint64_t id, std::future<NetworkTable::Reply> *reply);
 
     /*
      * Helper function which sends a message
@@ -135,26 +723,213 @@ class Connection {
      */
     void InterruptManageSocketThread();
 
+    /*
+     * Adds values to the write buffer, and asks
+     * the manage socket thread to flush it if it is full.
+     */
+    void BufferValues(const std::map<std::string, NetworkTable::Value> &values);
+
+    /*
+     * Asks the manage socket thread to call FlushWriteBuffer.
+     */
+    void RequestFlush();
+
+    /*
+     * Sends everything in the write buffer to the server as
+     * one request. Only called by the manage socket thread, so
+     * that buffered values always reach the server in order.
+     */
+    void FlushWriteBuffer(zmq::socket_t *socket);
+
+    /*
+     * Makes a new socket, and asks the server for a session on it.
+     * Also reopens the shared memory the server writes to, if enabled.
+     * Waits up to timeout_millis (-1 for forever) for the server to reply,
+     * while listening to mt_socket for a disconnect or interrupt.
+     */
+    SessionResult OpenSession(std::unique_ptr<zmq::socket_t> *socket, zmq::socket_t *mt_socket, \
+            int timeout_millis);
+
+    /*
+     * Keeps trying to open a session with exponential backoff,
+     * after the server stopped answering heartbeats.
+     * @return - SESSION_OPENED, unless Disconnect was called
+     *           or we were interrupted before it succeeded.
+     */
+    SessionResult Reconnect(std::unique_ptr<zmq::socket_t> *socket, zmq::socket_t *mt_socket);
+
+    /*
+     * Sends a request which the server replies to without doing
+     * anything, so that we hear from it even if nothing else is going on.
+     */
+    void SendHeartbeat(zmq::socket_t *socket);
+
+    /*
+     * Subscribes the new session to every uri with a callback or in
+     * the cache, and gets their nodes if refetching is enabled
+     * (see EnableReconnect). Only called by the manage socket thread.
+     */
+    void ReplaySubscriptions(zmq::socket_t *socket, zmq::socket_t *fanout_socket, \
+            std::set<std::string> *fanout_uris);
+
+    /*
+     * The histogram which round trips of this type
+     * of request go in, or nullptr if none do.
+     */
+    NetworkTable::LatencyHistogram *LatencyFor(NetworkTable::Request::Type type);
+
     void ManageSocket(int timeout_millis, bool async);
 
     zmq::context_t context_;
-    zmq::socket_t mst_socket_;
+    zmq::socket_t mst_socket_;  // Tells the manage socket thread to connect,
+                                // flush or disconnect. Requests go through
+                                // request_queue_ instead.
+    std::recursive_mutex mst_socket_mutex_;  // Zmq sockets can't be used by several threads at
+                                             // once. Recursive, as the thread holding it may
+                                             // need to interrupt the manage socket thread.
+    NetworkTable::RequestQueue<QueuedRequest> request_queue_;
 
     std::string socket_filepath_;  // Path to the socket used to connect to the server.
     std::thread socket_thread_;  // This interacts with the socket.
     std::atomic_bool connected_;  // True when connected to the server.
                                   // This is set by the manage socket thread
                                   // and read by the main thread.
+    int timeout_millis_;  // How long to wait for replies, -1 for forever.
+
+    std::mutex pending_requests_mutex_;
+    std::map<uint64_t, \
+        std::function<void(const NetworkTable::Reply *)>> pending_requests_;  // maps from request id
+                                                                             // to what to do with
+                                                                             // its reply.
+    std::atomic<uint64_t> next_request_id_;  // Request ids count up from 1, and are never
+                                             // reused, so a late reply can't be mistaken
+                                             // for the reply to a newer request. 0 is no id.
+    bool use_fanout_;  // True if subscriptions go through the server's fan-out socket.
+    bool use_shared_memory_;  // True if subscribe replies should be read from shared memory.
+    bool use_router_;  // True if connecting through the server's ZMQ_ROUTER socket.
+    uint64_t connection_id_;  // Picked at random on Connect, to tell us apart from other clients.
+    std::string routing_id_;  // What the server's ZMQ_ROUTER socket knows us by (connection_id_ in hex).
+    bool reconnect_;  // True if we reconnect when the server goes away.
+    bool refetch_on_reconnect_;  // True if subscribed nodes are fetched again after reconnecting.
+    std::string tcp_host_;  // Empty unless the server is reached over TCP.
+    int tcp_port_;
+    std::atomic<NetworkTable::Request::Priority> priority_;  // Set on every request.
+    std::atomic<uint64_t> publish_sequence_number_;  // Of the last Publish.
 
-    std::map<std::string, \
-        void(*)(NetworkTable::Node, \
-               const std::map<std::string, NetworkTable::Value> &, \
-               bool)> callbacks_;
+    int write_buffer_interval_millis_;  // 0 unless the write buffer is enabled.
+    size_t write_buffer_max_values_;
+    std::mutex write_buffer_mutex_;
+    std::map<std::string, NetworkTable::Value> write_buffer_;  // Values waiting to be sent.
+    std::vector<std::shared_ptr<\
+        std::promise<NetworkTable::Reply>>> flush_waiters_;  // Calls to Flush waiting for
+                                                             // the next flush to be acked.
 
-    // location of welcoming socket
-    const std::string kWelcome_Directory_ = "/tmp/sailbot/";  // NOLINT(runtime/string)
+    NetworkTable::SharedMemoryRing notification_ring_;  // Where the server writes subscribe replies.
+    std::thread shared_memory_thread_;  // Reads from notification_ring_.
+    std::atomic_bool reading_shared_memory_;  // Set to false to stop shared_memory_thread_.
+    std::atomic<std::chrono::steady_clock::rep> last_shared_memory_message_;  // When shared_memory_thread_
+                                                                            // last read anything, so the
+                                                                            // server was still there.
+
+    std::mutex callbacks_mutex_;  // Callbacks are run by the manage socket thread
+                                  // and shared memory thread, but set by the main thread.
+    std::map<std::string, Subscription> callbacks_;  // maps from subscribed uri to its callback.
+    int callback_threads_;  // 0 to run callbacks inline (see SetCallbackThreads).
+    NetworkTable::CallbackExecutor callback_executor_;
+    std::set<std::string> shared_memory_uris_;  // Subscriptions whose replies come
+                                                // through notification_ring_.
+
+    std::mutex cache_mutex_;  // The cache is updated by whichever thread
+                              // handles subscribe replies.
+    std::map<std::string, NetworkTable::CachedNode> cache_;  // maps from cached uri to its copy.
+                                                             // version is 0 until the first copy
+                                                             // arrives.
+
+    // Recorded for GetStats, and reset on Connect.
+    NetworkTable::LatencyHistogram connect_latency_;
+    NetworkTable::LatencyHistogram set_latency_;
+    NetworkTable::LatencyHistogram get_latency_;
+    NetworkTable::LatencyHistogram subscribe_latency_;
+    NetworkTable::LatencyHistogram callback_dispatch_latency_;
+    NetworkTable::LatencyHistogram callback_run_latency_;
+    NetworkTable::LatencyHistogram queue_wait_latency_;
+    std::atomic<uint64_t> timeouts_;
+    std::atomic<uint64_t> stale_replies_;
+    std::atomic<uint64_t> bytes_sent_;
+    std::atomic<uint64_t> bytes_received_;
+    int stats_dump_interval_millis_;  // 0 unless EnableStatsDump was called.
+
+    // location of welcoming socket, see Connection()
+    const std::string kWelcome_Directory_;
+
+    // shared memory which the server writes subscribe replies to
+    const std::string kSharedMemoryName_;
+
+    // size of the first block of the arenas which replies are parsed onto
+    static const size_t kArenaBlockSize_ = 16 * 1024;
+
+    // Publish drops writes once this many requests are waiting to be sent
+    static const size_t kMaxQueuedRequests_ = 1000;
+
+    // with reconnect enabled, how long the server can be quiet before a heartbeat
+    // is sent, and before it is taken to be gone
+    static const int kHeartbeatIntervalMillis_ = 1000;
+    static const int kHeartbeatTimeoutMillis_ = 3000;
+
+    // how long the first attempt to reconnect waits for the server, and the most any attempt does
+    static const int kMinReconnectMillis_ = 10;
+    static const int kMaxReconnectMillis_ = 2000;
+
+    // how long closing the socket waits to deliver the disconnect
+    // (and anything flushed just before it) to the server
+    static const int kDisconnectLingerMillis_ = 1000;
 };
 
+template <typename T>
+void Connection::Set(const std::string &uri, const T &value) {
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::SETVALUES);
+    ValueTraits<typename std::decay<T>::type>::ToValue(value, \
+            &(*request.mutable_setvalues_request()->mutable_values())[uri]);
+    SendSetValues(&request);
+}
+
+template <typename T>
+void Connection::Set(const std::map<std::string, T> &values) {
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::SETVALUES);
+    auto *mutable_values = request.mutable_setvalues_request()->mutable_values();
+    for (const auto &entry : values) {
+        ValueTraits<T>::ToValue(entry.second, &(*mutable_values)[entry.first]);
+    }
+    SendSetValues(&request);
+}
+
+template <typename... Pairs>
+void Connection::SetMany(const Pairs &... uri_values) {
+    NetworkTable::Request request;
+    request.set_type(NetworkTable::Request::SETVALUES);
+    AddValues(request.mutable_setvalues_request()->mutable_values(), uri_values...);
+    SendSetValues(&request);
+}
+
+template <typename Uri, typename T, typename... Pairs>
+void Connection::AddValues(google::protobuf::Map<std::string, NetworkTable::Value> *values, \
+        const std::pair<Uri, T> &uri_value, const Pairs &... rest) {
+    ValueTraits<typename std::decay<T>::type>::ToValue(uri_value.second, &(*values)[uri_value.first]);
+    AddValues(values, rest...);
+}
+
+template <typename T>
+T Connection::Get(const std::string &uri) {
+    NetworkTable::Value value = GetValue(uri);
+    if (value.type() != ValueTraits<T>::kType) {
+        throw std::runtime_error(uri + " has type " + NetworkTable::Value::Type_Name(value.type()) \
+                + ", not " + NetworkTable::Value::Type_Name(ValueTraits<T>::kType));
+    }
+    return ValueTraits<T>::FromValue(value);
+}
+
 /*
  * This exception can be thrown if a request to the server times out.
  * A timeout can occur because the server is busy, or because
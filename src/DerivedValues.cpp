@@ -0,0 +1,355 @@
+// Copyright 2017 UBC Sailbot
+
+#include "DerivedValues.h"
+#include "Exceptions.h"
+#include "Help.h"
+
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+// Helper function
+// Removes leading/trailing '/' so that "/gps/lat"
+// and "gps/lat" refer to the same input.
+static std::string NormalizeUri(std::string uri) {
+    boost::trim_if(uri, boost::is_any_of("/"));
+    return uri;
+}
+
+// Helper function
+// Expands "{a..b}" ranges in a uri, eg. "bms_{0..2}/uccm/current"
+// becomes bms_0/uccm/current, bms_1/uccm/current and bms_2/uccm/current.
+static std::vector<std::string> ExpandRanges(const std::string &uri) {
+    size_t open_idx = uri.find('{');
+    if (open_idx == std::string::npos) {
+        return {uri};
+    }
+
+    size_t close_idx = uri.find('}', open_idx);
+    size_t dots_idx = uri.find("..", open_idx);
+    if (close_idx == std::string::npos || dots_idx == std::string::npos || dots_idx > close_idx) {
+        throw std::runtime_error("bad range in: " + uri);
+    }
+
+    int first = std::stoi(uri.substr(open_idx + 1, dots_idx - open_idx - 1));
+    int last = std::stoi(uri.substr(dots_idx + 2, close_idx - dots_idx - 2));
+
+    std::vector<std::string> expanded;
+    for (int i = first; i <= last; i++) {
+        std::string with_number = uri.substr(0, open_idx) + std::to_string(i) + uri.substr(close_idx + 1);
+        for (const std::string &rest : ExpandRanges(with_number)) {
+            expanded.push_back(rest);
+        }
+    }
+    return expanded;
+}
+
+NetworkTable::DerivedValues::DerivedValues() {
+}
+
+void NetworkTable::DerivedValues::Load(const std::vector<std::string> &declarations) {
+    std::vector<Declaration> parsed;
+    std::map<std::string, size_t> producers;  // maps from a derived uri to the index
+                                              // of the declaration which sets it.
+
+    for (std::string line : declarations) {
+        boost::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t equals_idx = line.find('=');
+        size_t open_idx = line.find('(');
+        size_t close_idx = line.rfind(')');
+        if (equals_idx == std::string::npos || open_idx == std::string::npos \
+                || close_idx == std::string::npos || !(equals_idx < open_idx && open_idx < close_idx)) {
+            throw std::runtime_error("could not parse derived value: " + line);
+        }
+
+        Declaration declaration;
+        declaration.uri = NormalizeUri(boost::trim_copy(line.substr(0, equals_idx)));
+        declaration.function = boost::trim_copy(line.substr(equals_idx + 1, open_idx - equals_idx - 1));
+        declaration.stale_millis = 0;
+
+        std::vector<std::string> args;
+        std::string args_string = line.substr(open_idx + 1, close_idx - open_idx - 1);
+        boost::split(args, args_string, boost::is_any_of(","));
+        for (std::string &arg : args) {
+            boost::trim(arg);
+        }
+
+        if (declaration.function == "stale") {
+            if (args.size() != 2) {
+                throw std::runtime_error("stale takes a uri and a number of milliseconds: " + line);
+            }
+            declaration.inputs.push_back(NormalizeUri(args[0]));
+            declaration.stale_millis = std::stoi(args[1]);
+        } else if (declaration.function == "avg" || declaration.function == "sum" \
+                || declaration.function == "min" || declaration.function == "max" \
+                || declaration.function == "count") {
+            for (const std::string &arg : args) {
+                for (const std::string &input : ExpandRanges(arg)) {
+                    declaration.inputs.push_back(NormalizeUri(input));
+                }
+            }
+        } else {
+            throw std::runtime_error("unknown function '" + declaration.function + "' in: " + line);
+        }
+
+        if (declaration.uri.empty() || producers.count(declaration.uri) > 0) {
+            throw std::runtime_error("derived value declared twice (or empty uri): " + line);
+        }
+        producers[declaration.uri] = parsed.size();
+        parsed.push_back(declaration);
+    }
+
+    // Sort the declarations so that anything used as an input to
+    // another derived value comes before it (Kahn's algorithm).
+    // Then a single pass in index order always sees up to date inputs.
+    std::vector<std::vector<size_t>> edges(parsed.size());
+    std::vector<int> num_inputs(parsed.size(), 0);
+    for (size_t i = 0; i < parsed.size(); i++) {
+        for (const std::string &input : parsed[i].inputs) {
+            auto producer = producers.find(input);
+            if (producer != producers.end()) {
+                edges[producer->second].push_back(i);
+                num_inputs[i]++;
+            }
+        }
+    }
+
+    std::queue<size_t> ready;
+    for (size_t i = 0; i < parsed.size(); i++) {
+        if (num_inputs[i] == 0) {
+            ready.push(i);
+        }
+    }
+
+    std::vector<Declaration> sorted;
+    while (!ready.empty()) {
+        size_t i = ready.front();
+        ready.pop();
+        sorted.push_back(parsed[i]);
+        for (size_t dependent : edges[i]) {
+            if (--num_inputs[dependent] == 0) {
+                ready.push(dependent);
+            }
+        }
+    }
+
+    if (sorted.size() != parsed.size()) {
+        throw std::runtime_error("derived values depend on each other in a cycle");
+    }
+
+    declarations_ = sorted;
+    dependents_.clear();
+    for (size_t i = 0; i < declarations_.size(); i++) {
+        for (const std::string &input : declarations_[i].inputs) {
+            dependents_[input].push_back(i);
+        }
+    }
+
+    last_values_.clear();
+    last_set_.clear();
+    fresh_.clear();
+}
+
+void NetworkTable::DerivedValues::LoadFile(const std::string &filepath) {
+    std::ifstream input_filestream(filepath);
+    if (!input_filestream) {
+        throw std::runtime_error("could not open derived values file: " + filepath);
+    }
+
+    std::vector<std::string> declarations;
+    std::string line;
+    while (std::getline(input_filestream, line)) {
+        declarations.push_back(line);
+    }
+
+    Load(declarations);
+}
+
+std::map<std::string, NetworkTable::Value> NetworkTable::DerivedValues::Update(\
+        const std::set<std::string> &uris, NetworkTable::Node *root) {
+    std::set<size_t> dirty;
+    for (const std::string &uri : uris) {
+        std::string input = NormalizeUri(uri);
+        auto dependents = dependents_.find(input);
+        if (dependents == dependents_.end()) {
+            continue;
+        }
+
+        for (size_t i : dependents->second) {
+            if (declarations_[i].function == "stale") {
+                last_set_[input] = clock::now();
+            }
+            dirty.insert(i);
+        }
+    }
+
+    return Recompute(dirty, root);
+}
+
+std::map<std::string, NetworkTable::Value> NetworkTable::DerivedValues::UpdateAll(NetworkTable::Node *root) {
+    std::set<size_t> dirty;
+    for (size_t i = 0; i < declarations_.size(); i++) {
+        dirty.insert(i);
+    }
+
+    return Recompute(dirty, root);
+}
+
+std::map<std::string, NetworkTable::Value> NetworkTable::DerivedValues::Expire(NetworkTable::Node *root) {
+    std::set<size_t> dirty;
+    for (size_t i : fresh_) {
+        const Declaration &declaration = declarations_[i];
+        auto expiry = last_set_[declaration.inputs[0]] + std::chrono::milliseconds(declaration.stale_millis);
+        if (clock::now() >= expiry) {
+            dirty.insert(i);
+        }
+    }
+
+    return Recompute(dirty, root);
+}
+
+int NetworkTable::DerivedValues::MillisUntilExpiry() {
+    int millis = -1;
+    for (size_t i : fresh_) {
+        const Declaration &declaration = declarations_[i];
+        auto expiry = last_set_[declaration.inputs[0]] + std::chrono::milliseconds(declaration.stale_millis);
+        int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(expiry - clock::now()).count();
+        remaining = std::max(remaining, 0);
+        if (millis == -1 || remaining < millis) {
+            millis = remaining;
+        }
+    }
+    return millis;
+}
+
+bool NetworkTable::DerivedValues::Empty() const {
+    return declarations_.empty();
+}
+
+std::map<std::string, NetworkTable::Value> NetworkTable::DerivedValues::Recompute(std::set<size_t> dirty, \
+        NetworkTable::Node *root) {
+    std::map<std::string, NetworkTable::Value> results;
+
+    // Dependents always have a larger index than their inputs,
+    // so taking the smallest dirty index each time means every
+    // declaration is evaluated at most once, after its inputs.
+    while (!dirty.empty()) {
+        size_t i = *dirty.begin();
+        dirty.erase(dirty.begin());
+        const Declaration &declaration = declarations_[i];
+
+        NetworkTable::Value value;
+        if (!Evaluate(i, results, root, &value)) {
+            continue;
+        }
+
+        // Only publish values which actually changed.
+        std::string serialized_value = value.SerializeAsString();
+        auto last_value = last_values_.find(declaration.uri);
+        if (last_value != last_values_.end() && last_value->second == serialized_value) {
+            continue;
+        }
+        last_values_[declaration.uri] = serialized_value;
+        results[declaration.uri] = value;
+
+        auto dependents = dependents_.find(declaration.uri);
+        if (dependents != dependents_.end()) {
+            for (size_t dependent : dependents->second) {
+                if (declarations_[dependent].function == "stale") {
+                    last_set_[declaration.uri] = clock::now();
+                }
+                dirty.insert(dependent);
+            }
+        }
+    }
+
+    return results;
+}
+
+bool NetworkTable::DerivedValues::Evaluate(size_t index, \
+        const std::map<std::string, NetworkTable::Value> &results, \
+        NetworkTable::Node *root, NetworkTable::Value *result) {
+    const Declaration &declaration = declarations_[index];
+
+    if (declaration.function == "stale") {
+        auto last_set = last_set_.find(declaration.inputs[0]);
+        bool is_stale = last_set == last_set_.end() \
+            || clock::now() - last_set->second >= std::chrono::milliseconds(declaration.stale_millis);
+        if (is_stale) {
+            fresh_.erase(index);
+        } else {
+            fresh_.insert(index);
+        }
+
+        result->set_type(NetworkTable::Value::BOOL);
+        result->set_bool_data(is_stale);
+        return true;
+    }
+
+    std::vector<double> numbers;
+    bool all_ints = true;
+    for (const std::string &input : declaration.inputs) {
+        NetworkTable::Value value;
+        auto derived_input = results.find(input);
+        if (derived_input != results.end()) {
+            value = derived_input->second;
+        } else {
+            try {
+                value = NetworkTable::GetNode(input, root).value();
+            } catch (const NetworkTable::NodeNotFoundException &e) {
+                continue;
+            }
+        }
+
+        switch (value.type()) {
+            case NetworkTable::Value::INT : numbers.push_back(value.int_data());
+                                            break;
+            case NetworkTable::Value::FLOAT : numbers.push_back(value.float_data());
+                                              all_ints = false;
+                                              break;
+            case NetworkTable::Value::BOOL : numbers.push_back(value.bool_data());
+                                             break;
+            default: break;  // Not a number, so leave it out.
+        }
+    }
+
+    if (declaration.function == "count") {
+        result->set_type(NetworkTable::Value::INT);
+        result->set_int_data(numbers.size());
+        return true;
+    }
+
+    if (numbers.empty()) {
+        return false;
+    }
+
+    double number = 0;
+    if (declaration.function == "sum" || declaration.function == "avg") {
+        for (double n : numbers) {
+            number += n;
+        }
+        if (declaration.function == "avg") {
+            number /= numbers.size();
+            all_ints = false;
+        }
+    } else if (declaration.function == "min") {
+        number = *std::min_element(numbers.begin(), numbers.end());
+    } else if (declaration.function == "max") {
+        number = *std::max_element(numbers.begin(), numbers.end());
+    }
+
+    if (all_ints) {
+        result->set_type(NetworkTable::Value::INT);
+        result->set_int_data(static_cast<int>(number));
+    } else {
+        result->set_type(NetworkTable::Value::FLOAT);
+        result->set_float_data(static_cast<float>(number));
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef DERIVEDVALUES_H_
+#define DERIVEDVALUES_H_
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Node.pb.h"
+#include "Value.pb.h"
+
+namespace NetworkTable {
+/*
+ * Values which the server computes from other values in the table,
+ * so that clients don't have to subscribe to everything and write
+ * the results back themselves.
+ *
+ * Each derived value is declared on its own line as:
+ *     <uri> = <function>(<uri>, <uri>, ...)
+ * eg.
+ *     wind/average_speed = avg(wind_sensor_{0..2}/iimwv/wind_speed)
+ *     bms/total_current = sum(bms_{0..5}/uccm/current)
+ *     gps_0/is_stale = stale(gps_0/gprmc/latitude, 5000)
+ *
+ * "{a..b}" expands to every integer from a to b.
+ * Supported functions are avg, sum, min, max, count and stale.
+ * stale(uri, millis) is true if uri hasn't been set in the last millis.
+ * Derived values can be used as inputs to other derived values.
+ * Lines starting with '#' are ignored.
+ */
+class DerivedValues {
+ public:
+    DerivedValues();
+
+    /*
+     * Parses the declarations and builds the dependency graph.
+     * Any previously loaded declarations are replaced.
+     * @throws - std::runtime_error if a declaration can't be parsed,
+     *           or if the derived values depend on each other in a cycle.
+     */
+    void Load(const std::vector<std::string> &declarations);
+
+    /*
+     * Reads declarations from a file, one per line, then loads them.
+     */
+    void LoadFile(const std::string &filepath);
+
+    /*
+     * Recomputes any derived values which depend (directly or not)
+     * on the uris which changed. Values which are the same as
+     * they were last time are not returned.
+     * @param uris - uris which were just set in root.
+     * @param root - the table to read inputs from. Not modified.
+     * @return - map from derived uri to its new value.
+     */
+    std::map<std::string, NetworkTable::Value> Update(const std::set<std::string> &uris, \
+            NetworkTable::Node *root);
+
+    /*
+     * Recomputes every derived value, eg. after loading
+     * the table from disk.
+     * @return - same as Update.
+     */
+    std::map<std::string, NetworkTable::Value> UpdateAll(NetworkTable::Node *root);
+
+    /*
+     * Recomputes stale() values whose inputs have gone stale
+     * since the last call, along with anything depending on them.
+     * @return - same as Update.
+     */
+    std::map<std::string, NetworkTable::Value> Expire(NetworkTable::Node *root);
+
+    /*
+     * How long until a stale() value may change without any input
+     * changing, ie. when Expire should next be called.
+     * Returns -1 if that can't happen.
+     */
+    int MillisUntilExpiry();
+
+    bool Empty() const;
+
+ private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Declaration {
+        std::string uri;
+        std::string function;
+        std::vector<std::string> inputs;
+        int stale_millis;
+    };
+
+    /*
+     * Recomputes the given declarations (indices into declarations_),
+     * and everything which depends on them, in dependency order.
+     */
+    std::map<std::string, NetworkTable::Value> Recompute(std::set<size_t> dirty, \
+            NetworkTable::Node *root);
+
+    /*
+     * Evaluates a single declaration (index into declarations_).
+     * Inputs are looked up in results first, then in root.
+     * Returns false if none of its inputs exist yet.
+     */
+    bool Evaluate(size_t index, const std::map<std::string, NetworkTable::Value> &results, \
+            NetworkTable::Node *root, NetworkTable::Value *result);
+
+    std::vector<Declaration> declarations_;  // In dependency order, inputs first.
+    std::map<std::string, std::vector<size_t>> dependents_;  // maps from an input uri
+                                                             // to the declarations which use it.
+    std::map<std::string, std::string> last_values_;  // Serialized value last published for
+                                                      // each derived uri.
+    std::map<std::string, clock::time_point> last_set_;  // When each stale() input was last set.
+    std::set<size_t> fresh_;  // stale() declarations which are currently false.
+};
+}  // namespace NetworkTable
+
+#endif  // DERIVEDVALUES_H_
@@ -3,12 +3,14 @@
 #include "Help.h"
 #include "Exceptions.h"
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <vector>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <cstdio>
+#include <stdexcept>
 
 void PrintTree(NetworkTable::Node root, int depth);
 
@@ -69,27 +71,104 @@ void PrintTree(NetworkTable::Node root, int depth) {
     }
 }
 
+// Helper function
+// Get each "slice" of the uri. eg "/gps/lat/"
+// becomes {"gps", "lat"}. The root ("/" or "")
+// has no slices.
+static std::vector<std::string> SplitUri(std::string uri) {
+    boost::trim_left_if(uri, boost::is_any_of("/"));
+    boost::trim_right_if(uri, boost::is_any_of("/"));
+    std::vector<std::string> slices;
+    if (!uri.empty()) {
+        boost::split(slices, uri, boost::is_any_of("/"));
+    }
+    return slices;
+}
+
+// Helper function
+// Returns a pointer to the node at uri (without copying it),
+// or nullptr if it does not exist. Only uses the const accessors,
+// so it is safe to call from several readers at once.
+static const NetworkTable::Node *FindNode(const std::string &uri, const NetworkTable::Node *root) {
+    const NetworkTable::Node *current_node = root;
+    for (const std::string &slice : SplitUri(uri)) {
+        const auto &children = current_node->children();
+        auto child = children.find(slice);
+        if (child == children.end()) {
+            return nullptr;
+        }
+        current_node = &(child->second);
+    }
+    return current_node;
+}
+
 NetworkTable::Node NetworkTable::GetNode(std::string uri, NetworkTable::Node *root) {
-    if (uri == "/" || uri == "") {
-        return *root;
+    const NetworkTable::Node *node = FindNode(uri, root);
+    if (node == nullptr) {
+        throw NetworkTable::NodeNotFoundException("Could not find: " + uri);
     }
 
-    // Get each "slice" of the uri. eg "/gps/lat"
-    // becomes {"gps", "lat"}:
-    boost::trim_left_if(uri, boost::is_any_of("/"));
-    std::vector<std::string> slices;
-    boost::split(slices, uri, boost::is_any_of("/"));
+    return *node;
+}
 
-    NetworkTable::Node *current_node = root;
-    for (unsigned int i = 0; i < slices.size(); i++) {
-        if (current_node->children().find(slices[i]) != current_node->children().end()) {
-            current_node = &(current_node->mutable_children()->at(slices[i]));
-        } else {
-            throw NetworkTable::NodeNotFoundException("Could not find: " + uri);
+NetworkTable::Value NetworkTable::GetValue(std::string uri, NetworkTable::Node *root) {
+    const NetworkTable::Node *node = FindNode(uri, root);
+    if (node == nullptr) {
+        throw NetworkTable::NodeNotFoundException("Could not find: " + uri);
+    }
+
+    return node->value();
+}
+
+NetworkTable::Node NetworkTable::GetProjectedNode(std::string uri, const std::set<std::string> &fields, \
+        NetworkTable::Node *root) {
+    const NetworkTable::Node *node = FindNode(uri, root);
+    if (node == nullptr) {
+        throw NetworkTable::NodeNotFoundException("Could not find: " + uri);
+    }
+
+    NetworkTable::Node projected_node;
+    if (node->has_value()) {
+        projected_node.mutable_value()->CopyFrom(node->value());
+    }
+
+    for (const std::string &field : fields) {
+        const NetworkTable::Node *field_node = FindNode(field, node);
+        if (field_node == nullptr) {
+            continue;
+        }
+
+        // Create the intermediate nodes, then copy
+        // only the field's subtree across.
+        NetworkTable::Node *current_node = &projected_node;
+        for (const std::string &slice : SplitUri(field)) {
+            current_node = &(*current_node->mutable_children())[slice];
         }
+        current_node->CopyFrom(*field_node);
+    }
+
+    return projected_node;
+}
+
+bool NetworkTable::IsDescendant(std::string uri, std::string ancestor_uri) {
+    std::vector<std::string> slices = SplitUri(uri);
+    std::vector<std::string> ancestor_slices = SplitUri(ancestor_uri);
+    if (ancestor_slices.size() > slices.size()) {
+        return false;
     }
 
-    return *current_node;
+    return std::equal(ancestor_slices.begin(), ancestor_slices.end(), slices.begin());
+}
+
+std::string NetworkTable::RelativeUri(std::string uri, std::string ancestor_uri) {
+    std::vector<std::string> slices = SplitUri(uri);
+    size_t num_ancestor_slices = SplitUri(ancestor_uri).size();
+    if (num_ancestor_slices >= slices.size()) {
+        return "";
+    }
+
+    return boost::algorithm::join(std::vector<std::string>(slices.begin() + num_ancestor_slices, \
+                slices.end()), "/");
 }
 
 void NetworkTable::SetNode(std::string uri, NetworkTable::Value value, NetworkTable::Node *root) {
@@ -112,6 +191,68 @@ void NetworkTable::SetNode(std::string uri, NetworkTable::Value value, NetworkTa
     current_node->set_allocated_value(new NetworkTable::Value(value));
 }
 
+bool NetworkTable::ModifyValue(const NetworkTable::ModifyValueRequest &request, \
+        const NetworkTable::Value *current, NetworkTable::Value *result) {
+    const NetworkTable::Value &value = request.value();
+
+    if (request.operation() == NetworkTable::ModifyValueRequest::COMPARE_AND_SET) {
+        // Values don't contain any maps, so equal values
+        // always serialize to the same bytes.
+        bool matches = request.has_expected() \
+            ? current != nullptr && current->SerializeAsString() == request.expected().SerializeAsString() \
+            : current == nullptr;
+        if (!matches) {
+            if (current != nullptr) {
+                *result = *current;
+            } else {
+                result->Clear();
+            }
+            return false;
+        }
+        *result = value;
+        return true;
+    }
+
+    if (current == nullptr) {
+        *result = value;
+        return true;
+    }
+    *result = *current;
+
+    if (request.operation() == NetworkTable::ModifyValueRequest::INCREMENT) {
+        if (current->type() == NetworkTable::Value::INT && value.type() == NetworkTable::Value::INT) {
+            result->set_int_data(current->int_data() + value.int_data());
+        } else if (current->type() == NetworkTable::Value::FLOAT && value.type() == NetworkTable::Value::INT) {
+            result->set_float_data(current->float_data() + value.int_data());
+        } else if (current->type() == NetworkTable::Value::FLOAT && value.type() == NetworkTable::Value::FLOAT) {
+            result->set_float_data(current->float_data() + value.float_data());
+        } else {
+            throw std::runtime_error("can't increment " + request.uri() + " by a value of that type");
+        }
+        return true;
+    }
+
+    if (request.operation() == NetworkTable::ModifyValueRequest::APPEND) {
+        if (current->type() != value.type()) {
+            throw std::runtime_error("can't append a value of a different type to " + request.uri());
+        }
+        switch (current->type()) {
+            case NetworkTable::Value::STRING: result->set_string_data(current->string_data() + value.string_data());
+                                              break;
+            case NetworkTable::Value::BYTES: result->set_bytes_data(current->bytes_data() + value.bytes_data());
+                                             break;
+            case NetworkTable::Value::WAYPOINTS: result->mutable_waypoints()->MergeFrom(value.waypoints());
+                                                 break;
+            case NetworkTable::Value::BOATS: result->mutable_boats()->MergeFrom(value.boats());
+                                             break;
+            default: throw std::runtime_error("can't append to " + request.uri() + ", it isn't a list");
+        }
+        return true;
+    }
+
+    throw std::runtime_error("unknown operation on " + request.uri());
+}
+
 void NetworkTable::Write(std::string filepath, const NetworkTable::Node &root) {
     /*
      * Instead of writing to the actual file,
@@ -3,11 +3,13 @@
 #ifndef HELP_H_
 #define HELP_H_
 
+#include <set>
 #include <string>
 
 #include "Uccms.pb.h"
 #include "Sensors.pb.h"
 #include "Value.pb.h"
+#include "ModifyValueRequest.pb.h"
 #include "Node.pb.h"
 
 namespace NetworkTable {
@@ -24,6 +26,42 @@ void PrintNode(const NetworkTable::Node &root);
  */
 NetworkTable::Node GetNode(std::string uri, NetworkTable::Node *root);
 
+/*
+ * Returns the value of the node at given uri,
+ * without copying the rest of the node.
+ * @throws - NodeNotFoundException if the node at the uri doesn't exist
+ */
+NetworkTable::Value GetValue(std::string uri, NetworkTable::Node *root);
+
+/*
+ * Returns a copy of the node at given uri, but only containing
+ * the descendants found at the paths in fields. Paths in fields
+ * are relative to uri, eg. uri "/gps_0" with field "gprmc/latitude".
+ * Fields which don't exist in the tree are left out.
+ * Does not modify root.
+ * @param uri - path to the node to get, seperated by '/'.
+ * @param fields - paths relative to uri which should be kept.
+ * @param root - root node that uri indexes into
+ * @throws - NodeNotFoundException if the node at the uri doesn't exist
+ */
+NetworkTable::Node GetProjectedNode(std::string uri, const std::set<std::string> &fields, \
+        NetworkTable::Node *root);
+
+/*
+ * Returns true if uri is the same node as, or a descendant of,
+ * ancestor_uri. Leading/trailing '/' are ignored,
+ * so "/gps/lat" is a descendant of "gps".
+ */
+bool IsDescendant(std::string uri, std::string ancestor_uri);
+
+/*
+ * Returns the path from ancestor_uri down to uri,
+ * eg. "gprmc/latitude" for uri "/gps_0/gprmc/latitude"
+ * and ancestor_uri "gps_0", or "" if they are the same node.
+ * uri must be a descendant of ancestor_uri (see IsDescendant).
+ */
+std::string RelativeUri(std::string uri, std::string ancestor_uri);
+
 /*
  * Sets a given node in the tree. Creates the intermediate nodes
  * if they don't exist.
@@ -34,6 +72,24 @@ NetworkTable::Node GetNode(std::string uri, NetworkTable::Node *root);
  */
 void SetNode(std::string uri, NetworkTable::Value value, NetworkTable::Node *root);
 
+/*
+ * Works out what the value at a uri becomes after a
+ * compare and set, increment or append.
+ * COMPARE_AND_SET only succeeds if current equals request.expected(),
+ * or if expected is unset and there is no current value.
+ * INCREMENT adds an int or float to a number.
+ * APPEND adds to the end of a string, bytes, waypoints or boats.
+ * If there is no current value, INCREMENT and APPEND just use request.value().
+ * @param current - the value at the uri now, or nullptr if there isn't one.
+ * @param result - set to the new value, or to the current value
+ *                 if the compare and set didn't match.
+ * @return - false if a compare and set didn't match.
+ * @throws - std::runtime_error if the operation doesn't make sense
+ *           for the type of current.
+ */
+bool ModifyValue(const NetworkTable::ModifyValueRequest &request, \
+        const NetworkTable::Value *current, NetworkTable::Value *result);
+
 /*
  * Writes a node to disk.
  */
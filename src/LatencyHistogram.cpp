@@ -0,0 +1,69 @@
+// Copyright 2017 UBC Sailbot
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+
+double NetworkTable::LatencyStats::PercentileMicros(double fraction) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    // The first bucket which takes the running
+    // total to at least fraction of the count.
+    uint64_t total = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        total += buckets[i];
+        if (total >= fraction * count) {
+            return static_cast<double>(uint64_t(1) << i);
+        }
+    }
+    return static_cast<double>(uint64_t(1) << (buckets.size() - 1));
+}
+
+NetworkTable::LatencyHistogram::LatencyHistogram() {
+    Reset();
+}
+
+void NetworkTable::LatencyHistogram::Record(std::chrono::steady_clock::duration duration) {
+    uint64_t nanos = std::max(static_cast<int64_t>(0), static_cast<int64_t>(\
+                std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+
+    // The bucket is the number of bits needed for the micros,
+    // so 0 us goes in bucket 0, 1 us in 1, 2-3 us in 2, and so on.
+    uint64_t micros = nanos / 1000;
+    int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    buckets_[std::min(bucket, kNumBuckets - 1)]++;
+    count_++;
+    total_nanos_ += nanos;
+
+    uint64_t max_nanos = max_nanos_.load(std::memory_order_relaxed);
+    while (nanos > max_nanos && !max_nanos_.compare_exchange_weak(max_nanos, nanos)) {
+    }
+}
+
+void NetworkTable::LatencyHistogram::RecordSince(std::chrono::steady_clock::time_point start) {
+    Record(std::chrono::steady_clock::now() - start);
+}
+
+NetworkTable::LatencyStats NetworkTable::LatencyHistogram::Read() const {
+    // Each counter is read on its own, so a recording
+    // made while reading may only be partly counted.
+    LatencyStats stats;
+    stats.count = count_;
+    stats.mean_micros = stats.count == 0 ? 0 : total_nanos_ / 1000.0 / stats.count;
+    stats.max_micros = max_nanos_ / 1000.0;
+    for (int i = 0; i < kNumBuckets; i++) {
+        stats.buckets.push_back(buckets_[i]);
+    }
+    return stats;
+}
+
+void NetworkTable::LatencyHistogram::Reset() {
+    for (int i = 0; i < kNumBuckets; i++) {
+        buckets_[i] = 0;
+    }
+    count_ = 0;
+    total_nanos_ = 0;
+    max_nanos_ = 0;
+}
@@ -0,0 +1,65 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef LATENCYHISTOGRAM_H_
+#define LATENCYHISTOGRAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace NetworkTable {
+/*
+ * The times recorded by a LatencyHistogram, as of when
+ * it was read.
+ */
+struct LatencyStats {
+    uint64_t count;
+    double mean_micros;
+    double max_micros;
+    std::vector<uint64_t> buckets;  // How many times fell in each bucket (see LatencyHistogram).
+
+    /*
+     * The time which fraction (eg. 0.99) of the recorded times
+     * were under, rounded up to the end of its bucket.
+     * 0 if nothing was recorded.
+     */
+    double PercentileMicros(double fraction) const;
+};
+
+/*
+ * Counts how long something took, eg. a round trip to the
+ * server, in buckets which double in size. Record doesn't take
+ * a lock, so any number of threads can record at once.
+ */
+class LatencyHistogram {
+ public:
+    // Bucket 0 counts times under 1 us, and bucket i times from
+    // 2^(i-1) up to 2^i us. The last bucket counts anything longer.
+    static const int kNumBuckets = 32;
+
+    LatencyHistogram();
+
+    void Record(std::chrono::steady_clock::duration duration);
+
+    /*
+     * Records how long it has been since start.
+     */
+    void RecordSince(std::chrono::steady_clock::time_point start);
+
+    LatencyStats Read() const;
+
+    /*
+     * Forgets everything recorded so far.
+     */
+    void Reset();
+
+ private:
+    std::atomic<uint64_t> buckets_[kNumBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> total_nanos_;
+    std::atomic<uint64_t> max_nanos_;
+};
+}  // namespace NetworkTable
+
+#endif  // LATENCYHISTOGRAM_H_
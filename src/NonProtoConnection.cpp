@@ -12,75 +12,35 @@ NetworkTable::NonProtoConnection::NonProtoConnection() {
 }
 
 void NetworkTable::NonProtoConnection::SetIntValue(const std::string &uri, const int &value) {
-    std::map<std::string, int> values = {{uri, value}};
-    SetIntValues(values);
+    Set(uri, value);
 }
 
 void NetworkTable::NonProtoConnection::SetIntValues(const std::map<std::string, int> &values) {
-    std::map<std::string, NetworkTable::Value> proto_values;
-    for (auto const &entry : values) {
-        std::string uri = entry.first;
-        NetworkTable::Value int_val;
-        int_val.set_type(NetworkTable::Value::INT);
-        int_val.set_int_data(entry.second);
-        proto_values[uri] = int_val;
-    }
-
-    SetValues(proto_values);
+    Set(values);
 }
 
 void NetworkTable::NonProtoConnection::SetFloatValue(const std::string &uri, const float &value) {
-    std::map<std::string, float> values = {{uri, value}};
-    SetFloatValues(values);
+    Set(uri, value);
 }
 
 void NetworkTable::NonProtoConnection::SetFloatValues(const std::map<std::string, float> &values) {
-    std::map<std::string, NetworkTable::Value> proto_values;
-    for (auto const &entry : values) {
-        std::string uri = entry.first;
-        NetworkTable::Value float_val;
-        float_val.set_type(NetworkTable::Value::FLOAT);
-        float_val.set_float_data(entry.second);
-        proto_values[uri] = float_val;
-    }
-
-    SetValues(proto_values);
+    Set(values);
 }
 
 void NetworkTable::NonProtoConnection::SetStringValue(const std::string &uri, const std::string &value) {
-    std::map<std::string, std::string> values = {{uri, value}};
-    SetStringValues(values);
+    Set(uri, value);
 }
 
 void NetworkTable::NonProtoConnection::SetStringValues(const std::map<std::string, std::string> &values) {
-    std::map<std::string, NetworkTable::Value> proto_values;
-    for (auto const &entry : values) {
-        std::string uri = entry.first;
-        NetworkTable::Value string_val;
-        string_val.set_type(NetworkTable::Value::STRING);
-        string_val.set_string_data(entry.second);
-        proto_values[uri] = string_val;
-    }
-
-    SetValues(proto_values);
+    Set(values);
 }
 
 void NetworkTable::NonProtoConnection::SetBooleanValue(const std::string &uri, const bool &value) {
-    std::map<std::string, bool> values = {{uri, value}};
-    SetBooleanValues(values);
+    Set(uri, value);
 }
 
 void NetworkTable::NonProtoConnection::SetBooleanValues(const std::map<std::string, bool> &values) {
-    std::map<std::string, NetworkTable::Value> proto_values;
-    for (auto const &entry : values) {
-        std::string uri = entry.first;
-        NetworkTable::Value bool_val;
-        bool_val.set_type(NetworkTable::Value::BOOL);
-        bool_val.set_bool_data(entry.second);
-        proto_values[uri] = bool_val;
-    }
-
-    SetValues(proto_values);
+    Set(values);
 }
 
 void NetworkTable::NonProtoConnection::SetWaypointValue(const std::pair<double, double> &value) {
@@ -106,6 +66,19 @@ void NetworkTable::NonProtoConnection::SetWaypointValues(const std::vector<std::
     SetValues(proto_values);
 }
 
+void NetworkTable::NonProtoConnection::AppendWaypointValues(const std::vector<std::pair<double, double>> &values) {
+    NetworkTable::Value waypoints_val;
+    waypoints_val.set_type(NetworkTable::Value::WAYPOINTS);
+
+    for (auto const &coordinates : values) {
+        NetworkTable::Value_Waypoint *waypoint = waypoints_val.add_waypoints();
+        waypoint->set_latitude(coordinates.first);
+        waypoint->set_longitude(coordinates.second);
+    }
+
+    Append("waypoints", waypoints_val);
+}
+
 std::list<std::pair<double, double>> NetworkTable::NonProtoConnection::GetCurrentWaypoints() {
     NetworkTable::Value waypoints_val;
     const std::string uri = "waypoints";
@@ -127,10 +100,12 @@ std::pair<double, double> NetworkTable::NonProtoConnection::GetCurrentGpsCoords(
     const std::string lat_uri = "gps/gprmc/latitude";
     const std::string lon_uri = "gps/gprmc/longitude";
 
+    // Get both in one request (or from the cache, see Connection::Cache).
     double lat, lon;
     std::pair<double, double> curr_gps;
-    lat = GetValue(lat_uri).int_data();
-    lon = GetValue(lon_uri).int_data();
+    auto values = GetValues({lat_uri, lon_uri});
+    lat = values[lat_uri].int_data();
+    lon = values[lon_uri].int_data();
 
     curr_gps.first = lat;
     curr_gps.second = lon;
@@ -96,6 +96,12 @@ class NonProtoConnection : public Connection {
      */
     void SetWaypointValues(const std::vector<std::pair<double, double>> &values);
 
+    /*
+     * Add gps Waypoints to the end of the current ones, in a single
+     * request, so that waypoints added by someone else aren't lost.
+     */
+    void AppendWaypointValues(const std::vector<std::pair<double, double>> &values);
+
 
     /*
      * Returns the current gps waypoint coordinates  
@@ -0,0 +1,123 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef REQUESTQUEUE_H_
+#define REQUESTQUEUE_H_
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace NetworkTable {
+/*
+ * A queue which any number of threads push items onto,
+ * and a single thread pops them from. Pushing never takes
+ * a lock or blocks.
+ *
+ * The popping thread doesn't need to spin: fd() is an eventfd
+ * which becomes readable when an item is pushed onto an empty
+ * queue, so it can be polled alongside sockets (eg. with zmq::poll).
+ */
+template <typename T>
+class RequestQueue {
+ public:
+    /*
+     * @throws - std::runtime_error if the eventfd can't be created.
+     */
+    RequestQueue() : head_(nullptr), size_(0), fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        if (fd_ == -1) {
+            throw std::runtime_error(std::string("failed to create eventfd: ") + strerror(errno));
+        }
+    }
+
+    ~RequestQueue() {
+        std::vector<T> items;
+        PopAll(&items);
+        close(fd_);
+    }
+
+    RequestQueue(const RequestQueue &) = delete;
+    RequestQueue &operator=(const RequestQueue &) = delete;
+
+    /*
+     * Adds item to the back of the queue.
+     * Safe to call from any thread.
+     */
+    void Push(T item) {
+        Entry *entry = new Entry{std::move(item), nullptr};
+        size_++;
+
+        // Items are pushed onto the front of a linked list,
+        // and PopAll reverses it.
+        Entry *head = head_.load(std::memory_order_relaxed);
+        do {
+            entry->next = head;
+        } while (!head_.compare_exchange_weak(head, entry, \
+                    std::memory_order_release, std::memory_order_relaxed));
+
+        // Only the push which makes the queue non-empty
+        // needs to wake the popping thread.
+        if (head == nullptr) {
+            uint64_t one = 1;
+            ssize_t written = write(fd_, &one, sizeof(one));
+            (void) written;
+        }
+    }
+
+    /*
+     * Moves every item in the queue onto the end of items,
+     * oldest first. Must only be called from one thread.
+     */
+    void PopAll(std::vector<T> *items) {
+        // Reset the eventfd before taking the items, so that
+        // a push after this wakes us up again.
+        uint64_t count;
+        ssize_t num_read = read(fd_, &count, sizeof(count));
+        (void) num_read;
+
+        Entry *entry = head_.exchange(nullptr, std::memory_order_acquire);
+        size_t first = items->size();
+        while (entry != nullptr) {
+            items->push_back(std::move(entry->item));
+            Entry *next = entry->next;
+            delete entry;
+            entry = next;
+            size_--;
+        }
+        std::reverse(items->begin() + first, items->end());
+    }
+
+    /*
+     * Number of items waiting to be popped.
+     */
+    size_t Size() const {
+        return size_;
+    }
+
+    /*
+     * Readable while there may be items to pop.
+     */
+    int fd() const {
+        return fd_;
+    }
+
+ private:
+    struct Entry {
+        T item;
+        Entry *next;
+    };
+
+    std::atomic<Entry*> head_;  // Newest item.
+    std::atomic<size_t> size_;
+    int fd_;
+};
+}  // namespace NetworkTable
+
+#endif  // REQUESTQUEUE_H_
@@ -23,19 +23,57 @@
 #include <fstream>
 #include <cstdio>
 #include <csignal>
+#include <pthread.h>
 #include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <utility>
 
 // Use this to check if we received
 // a signal, ex SIGINT
 static volatile sig_atomic_t signaled = 0;
 static volatile std::atomic<bool> signal_handler_registered(false);
 
-void signal_handler(int param) {
+static void signal_handler(int param) {
       signaled = 1;
 }
 
-NetworkTable::Server::Server()
-    : context_(1), welcome_socket_(context_, ZMQ_REP) {
+// Helper function
+// Returns true if message is the null terminated string text,
+// without copying the message into a std::string first.
+static bool MessageIs(const zmq::message_t &message, const char *text) {
+    size_t text_size = strlen(text) + 1;
+    return message.size() == text_size && memcmp(message.data(), text, text_size) == 0;
+}
+
+// Helper function
+// Options for an arena which starts out using block,
+// instead of allocating its first block itself.
+static google::protobuf::ArenaOptions ArenaOptionsWithBlock(char *block, size_t block_size) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = block_size;
+    return options;
+}
+
+// Passed by reference to setsockopt and std::chrono,
+// so these need a definition.
+const int NetworkTable::Server::kRouterClientTimeoutMillis_;
+const int NetworkTable::Server::kRouterHeartbeatIntervalMillis_;
+const int NetworkTable::Server::kRouterHeartbeatTimeoutMillis_;
+const int NetworkTable::Server::kWriteIntervalMillis_;
+
+NetworkTable::Server::Server(const std::string &directory, const std::string &shared_memory_name)
+    : context_(1), welcome_socket_(context_, ZMQ_REP), router_socket_(context_, ZMQ_ROUTER), \
+      fanout_socket_(context_, ZMQ_XPUB), \
+      has_deferred_router_message_(false), \
+      root_changed_(false), \
+      num_reader_threads_(kDefaultNumReaderThreads_), stop_reader_threads_(false), \
+      getnodes_replies_socket_(context_, ZMQ_PULL), \
+      arena_block_(new char[kArenaBlockSize_]), \
+      arena_(ArenaOptionsWithBlock(arena_block_.get(), kArenaBlockSize_)), \
+      kWelcome_Directory_(directory), \
+      kSharedMemoryName_(shared_memory_name) {
     // Register our signal handler.
     // After this, if we ctrl-c,
     // this function will be called, which allows
@@ -49,7 +87,42 @@ NetworkTable::Server::Server()
     boost::filesystem::create_directory(kWelcome_Directory_);
     boost::filesystem::create_directory(kClients_Directory_);
 
+    // Sending to a router client which isn't connected
+    // fails instead of being dropped, see ExpireRouterClients.
+    router_socket_.setsockopt(ZMQ_ROUTER_MANDATORY, 1);
+    router_socket_.setsockopt(ZMQ_HEARTBEAT_IVL, kRouterHeartbeatIntervalMillis_);
+    router_socket_.setsockopt(ZMQ_HEARTBEAT_TIMEOUT, kRouterHeartbeatTimeoutMillis_);
+    // A client which reconnects does so on a new socket with the
+    // same routing id, maybe before we notice the old one is gone.
+    // Let the new one take over instead of being turned away.
+    router_socket_.setsockopt(ZMQ_ROUTER_HANDOVER, 1);
+
+    // Pass on every subscription, not just the first to a topic,
+    // so that each subscriber gets confirmed (see UpdateFanoutTopics).
+    fanout_socket_.setsockopt(ZMQ_XPUB_VERBOSE, 1);
+
     welcome_socket_.bind("ipc://" + kWelcome_Directory_ + "NetworkTable");
+    router_socket_.bind("ipc://" + kWelcome_Directory_ + "NetworkTableRouter");
+    fanout_socket_.bind("ipc://" + kWelcome_Directory_ + "NetworkTableFanout");
+    getnodes_replies_socket_.bind(kGetNodesRepliesEndpoint_);
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1) {
+        throw std::runtime_error(std::string("epoll_create1 failed: ") + strerror(errno));
+    }
+    Watch(&welcome_socket_);
+    Watch(&router_socket_);
+    Watch(&fanout_socket_);
+    Watch(&getnodes_replies_socket_);
+
+    // Clients on this host can read subscribe replies
+    // straight out of shared memory. If it can't be set up,
+    // everyone just uses their ZMQ socket.
+    try {
+        notification_ring_.Create(kSharedMemoryName_, kSharedMemoryCapacity_);
+    } catch (const std::runtime_error &e) {
+        std::cout << "shared memory notifications disabled: " << e.what() << std::endl;
+    }
 
     ReconnectAbandonedSockets();
 
@@ -74,62 +147,175 @@ NetworkTable::Server::Server()
     }
 }
 
+NetworkTable::Server::~Server() {
+    {
+        std::lock_guard<std::mutex> lock(getnodes_queue_mutex_);
+        stop_reader_threads_ = true;
+    }
+    getnodes_queue_cv_.notify_all();
+    for (auto &reader_thread : reader_threads_) {
+        reader_thread.join();
+    }
+    close(epoll_fd_);
+}
+
 void NetworkTable::Server::Run() {
+    while (static_cast<int>(reader_threads_.size()) < num_reader_threads_) {
+        reader_threads_.emplace_back(&NetworkTable::Server::ServeGetNodes, this);
+    }
+
     while (true) {
-        // Poll all the zmq sockets.
-        // This includes welcome_socket_,
-        // and all the ZMQ_PAIR sockets which
-        // have been created.
-        int num_sockets = 1 + sockets_.size();
-        std::vector<zmq::pollitem_t> pollitems;
-
-        zmq::pollitem_t pollitem;
-        pollitem.socket = static_cast<void*>(welcome_socket_);
-        pollitem.events = ZMQ_POLLIN;
-        pollitems.push_back(pollitem);
-
-        for (unsigned int i = 0; i < sockets_.size(); i++) {
-            pollitem.socket = static_cast<void*>(*sockets_[i]);
-            pollitem.events = ZMQ_POLLIN;
-            pollitems.push_back(pollitem);
-        }
-
-        // Set the timeout to -1, which means poll
-        // indefinitely until something happens.
-        // This line will block until a socket is ready.
-        try {
-            zmq::poll(pollitems.data(), num_sockets, -1);
-        } catch(const zmq::error_t &e) {
-            if (signaled && e.num() == EINTR) {
-                throw NetworkTable::InterruptedException(e.what());
+        // Block until a socket is ready, unless some
+        // are still left over from last time.
+        // If there are derived values which go stale over time,
+        // or root_ needs saving, wake up in time to do it.
+        int timeout_millis = derived_values_.MillisUntilExpiry();
+        for (int millis : {MillisUntilWriteRoot(), MillisUntilExpireRouterClients()}) {
+            if (timeout_millis == -1 || (millis != -1 && millis < timeout_millis)) {
+                timeout_millis = millis;
             }
         }
-
-
-        if (pollitems[0].revents & ZMQ_POLLIN) {
-            CreateNewConnection();
+        if (!ready_sockets_.empty()) {
+            timeout_millis = 0;
+        }
+        struct epoll_event events[kMaxEpollEvents_];
+        int num_events = epoll_wait(epoll_fd_, events, kMaxEpollEvents_, timeout_millis);
+        if (num_events == -1) {
+            if (signaled && errno == EINTR) {
+                throw NetworkTable::InterruptedException(strerror(errno));
+            }
+            num_events = 0;
+        }
+        for (int i = 0; i < num_events; i++) {
+            ready_sockets_.insert(static_cast<zmq::socket_t*>(events[i].data.ptr));
         }
-        // Do not directly pass the sockets_ vector
-        // into the HandleRequest function.
-        // Instead pass in a copy of the sockets_ vector.
-        // This is because HandleRequest may call DisconnectSocket
-        // which will modify sockets_ (specifically,
-        // remove a socket from sockets_.
-        std::vector<socket_ptr> sockets_copy = sockets_;
 
-        for (int i = 0; i < num_sockets-1; i++) {
-            if (pollitems[i+1].revents & ZMQ_POLLIN) {
-                HandleRequest(sockets_copy[i]);
+        // Take one message from each ready socket (a few from
+        // each router client, see HandleRouterMessages), so that
+        // a busy client can't starve the others. Anything
+        // with more messages gets handled on the next loop.
+        // Work on a copy, since handling a message can
+        // add or remove sockets (eg. DisconnectClient).
+        std::set<zmq::socket_t*> ready_sockets;
+        std::swap(ready_sockets, ready_sockets_);
+        for (zmq::socket_t *socket : ready_sockets) {
+            if (HandleReadySocket(socket)) {
+                ready_sockets_.insert(socket);
             }
         }
+        HandleQueuedRequests();
+        ExpireRouterClients();
+
+        if (!derived_values_.Empty()) {
+            ExpireDerivedValues();
+        }
+        WriteRoot(false);
+
+        // Everything sent this loop has been serialized,
+        // so free the requests and replies all at once.
+        arena_.Reset();
+
         // If we got interrupted, we finish up what we were doing
         // and then exit.
         if (signaled) {
+            WriteRoot(true);
             throw NetworkTable::InterruptedException("Received interrupt signal");
         }
     }
 }
 
+void NetworkTable::Server::Watch(zmq::socket_t *socket) {
+    int fd;
+    size_t fd_size = sizeof(fd);
+    socket->getsockopt(ZMQ_FD, &fd, &fd_size);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = socket;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+
+    // Messages may have arrived before we started watching.
+    ready_sockets_.insert(socket);
+}
+
+void NetworkTable::Server::Unwatch(zmq::socket_t *socket) {
+    int fd;
+    size_t fd_size = sizeof(fd);
+    socket->getsockopt(ZMQ_FD, &fd, &fd_size);
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    ready_sockets_.erase(socket);
+}
+
+bool NetworkTable::Server::HandleReadySocket(zmq::socket_t *socket) {
+    // Client sockets can be disconnected by
+    // an earlier message in the same loop.
+    auto client_socket = sockets_.find(socket);
+    bool is_client_socket = client_socket != sockets_.end();
+    if (!is_client_socket && socket != &welcome_socket_ && socket != &router_socket_ \
+            && socket != &fanout_socket_ && socket != &getnodes_replies_socket_) {
+        return false;
+    }
+    if (socket == &router_socket_) {
+        return HandleRouterMessages();
+    }
+
+    // This also clears the signal on ZMQ_FD,
+    // so epoll won't wake us up for it again until
+    // a new message arrives.
+    int events;
+    size_t events_size = sizeof(events);
+    socket->getsockopt(ZMQ_EVENTS, &events, &events_size);
+    if (!(events & ZMQ_POLLIN)) {
+        return false;
+    }
+
+    if (socket == &welcome_socket_) {
+        CreateNewConnection();
+    } else if (socket == &fanout_socket_) {
+        UpdateFanoutTopics();
+    } else if (socket == &getnodes_replies_socket_) {
+        SendGetNodesReplies();
+    } else {
+        zmq::message_t message;
+        try {
+            socket->recv(&message);
+        } catch(const zmq::error_t &e) {
+            if (signaled && e.num() == EINTR) {
+                throw NetworkTable::InterruptedException(e.what());
+            }
+        }
+        QueueRequest(client_socket->second, message);
+    }
+    return true;
+}
+
+void NetworkTable::Server::LoadDerivedValues(const std::string &filepath) {
+    derived_values_.LoadFile(filepath);
+
+    // The table loaded from disk may already
+    // have the inputs, so compute everything once.
+    {
+        auto derived = derived_values_.UpdateAll(&root_);
+        std::unique_lock<std::shared_timed_mutex> lock(root_mutex_);
+        for (auto const &entry : derived) {
+            NetworkTable::SetNode(entry.first, entry.second, &root_);
+        }
+    }
+    NetworkTable::Write(kRootFilePath_, root_);
+}
+
+void NetworkTable::Server::SetNumReaderThreads(int num_reader_threads) {
+    num_reader_threads_ = std::max(num_reader_threads, 0);
+}
+
+void NetworkTable::Server::ListenOnTcp(const std::string &address, int port) {
+    // ZMQ sockets can be bound to several endpoints,
+    // so TCP clients share the same sockets as local ones.
+    router_socket_.bind("tcp://" + address + ":" + std::to_string(port));
+    fanout_socket_.bind("tcp://" + address + ":" + std::to_string(port + 1));
+}
+
 void NetworkTable::Server::CreateNewConnection() {
     zmq::message_t request;
     try {
@@ -142,7 +328,9 @@ void NetworkTable::Server::CreateNewConnection() {
 
     std::string message = static_cast<char*>(request.data());
 
-    if (message == "connect") {
+    // Clients which can read subscribe replies from
+    // shared memory ask for it when connecting.
+    if (message == "connect" || message == "connect shared_memory") {
         /* A new client has connected to Network Table Server.
          * Create a new ZMQ_PAIR socket, and send them
          * the location of it.
@@ -156,7 +344,13 @@ void NetworkTable::Server::CreateNewConnection() {
         // Add new socket to sockets_ and bind it.
         socket_ptr socket = std::make_shared<zmq::socket_t>(context_, ZMQ_PAIR);
         socket->bind("ipc://" + filepath);
-        sockets_.push_back(socket);
+        client_ptr client = std::make_shared<Client>(Client{socket, "", filepath, true, 0, 0, \
+                std::chrono::steady_clock::now()});
+        sockets_[socket.get()] = client;
+        Watch(socket.get());
+        if (message == "connect shared_memory" && notification_ring_.IsOpen()) {
+            shared_memory_clients_.insert(client);
+        }
 
         // Reply to client with location of socket.
         std::string reply_body = filepath;
@@ -183,6 +377,166 @@ void NetworkTable::Server::CreateNewConnection() {
     }
 }
 
+bool NetworkTable::Server::HandleRouterMessages() {
+    std::unordered_map<std::string, int> num_received;
+    if (has_deferred_router_message_) {
+        has_deferred_router_message_ = false;
+        num_received[std::string(static_cast<char*>(deferred_routing_id_.data()), \
+                deferred_routing_id_.size())]++;
+        HandleRouterMessage(&deferred_routing_id_, deferred_router_message_);
+    }
+
+    for (int i = 0; i < kMaxRouterMessagesPerLoop_; i++) {
+        // Messages are the client's routing id,
+        // followed by what the client sent.
+        zmq::message_t routing_id;
+        zmq::message_t message;
+        try {
+            if (!router_socket_.recv(&routing_id, ZMQ_DONTWAIT)) {
+                break;
+            }
+            if (!routing_id.more()) {
+                continue;
+            }
+            router_socket_.recv(&message);
+        } catch(const zmq::error_t &e) {
+            if (signaled && e.num() == EINTR) {
+                throw NetworkTable::InterruptedException(e.what());
+            }
+            break;
+        }
+
+        int &num_from_client = num_received[std::string(static_cast<char*>(routing_id.data()), \
+                routing_id.size())];
+        if (num_from_client == kMaxRouterMessagesPerClient_) {
+            deferred_routing_id_ = std::move(routing_id);
+            deferred_router_message_ = std::move(message);
+            has_deferred_router_message_ = true;
+            return true;
+        }
+        num_from_client++;
+        HandleRouterMessage(&routing_id, message);
+    }
+
+    // This also clears the signal on ZMQ_FD (see HandleReadySocket).
+    int events;
+    size_t events_size = sizeof(events);
+    router_socket_.getsockopt(ZMQ_EVENTS, &events, &events_size);
+    return events & ZMQ_POLLIN;
+}
+
+void NetworkTable::Server::HandleRouterMessage(zmq::message_t *routing_id, const zmq::message_t &message) {
+    client_ptr client = GetRouterClient(\
+            std::string(static_cast<char*>(routing_id->data()), routing_id->size()));
+    client->last_seen = std::chrono::steady_clock::now();
+
+    // Unlike with the welcome socket, there's nothing
+    // to create. Just let the client know we're here,
+    // and what its endpoint is.
+    if (MessageIs(message, "connect") || MessageIs(message, "connect shared_memory")) {
+        if (MessageIs(message, "connect shared_memory") && notification_ring_.IsOpen()) {
+            shared_memory_clients_.insert(client);
+        } else {
+            shared_memory_clients_.erase(client);
+        }
+
+        zmq::message_t reply(client->endpoint.size()+1);
+        memcpy(reply.data(), client->endpoint.c_str(), client->endpoint.size()+1);
+        try {
+            if (router_socket_.send(*routing_id, ZMQ_SNDMORE | ZMQ_DONTWAIT)) {
+                router_socket_.send(reply, ZMQ_DONTWAIT);
+            }
+        } catch(const zmq::error_t &e) {
+            if (signaled && e.num() == EINTR) {
+                throw NetworkTable::InterruptedException(e.what());
+            }
+        }
+        return;
+    }
+
+    QueueRequest(client, message);
+}
+
+NetworkTable::Server::client_ptr NetworkTable::Server::GetRouterClient(const std::string &routing_id) {
+    auto client = router_clients_.find(routing_id);
+    if (client != router_clients_.end()) {
+        return client->second;
+    }
+
+    client_ptr new_client = std::make_shared<Client>(\
+            Client{nullptr, routing_id, kRouterEndpointPrefix_ + routing_id, true, 0, 0, \
+                   std::chrono::steady_clock::now()});
+    router_clients_[routing_id] = new_client;
+    return new_client;
+}
+
+void NetworkTable::Server::ExpireRouterClients() {
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::milliseconds(kRouterClientTimeoutMillis_);
+    if (now - last_expire_router_clients_ >= timeout) {
+        last_expire_router_clients_ = now;
+        // Clients ignore replies without an id.
+        for (auto const &entry : router_clients_) {
+            if (now - entry.second->last_seen >= timeout) {
+                Ack(0, entry.second);
+            }
+        }
+    }
+
+    std::set<client_ptr> unreachable_clients;
+    std::swap(unreachable_clients, unreachable_router_clients_);
+    for (const client_ptr &client : unreachable_clients) {
+        if (client->connected && now - client->last_seen >= timeout) {
+            std::cout << "Disconnecting " << client->endpoint << ", it is gone" << std::endl;
+            DisconnectClient(client);
+        }
+    }
+}
+
+int NetworkTable::Server::MillisUntilExpireRouterClients() {
+    if (router_clients_.empty()) {
+        return -1;
+    }
+
+    auto next_expire = last_expire_router_clients_ + std::chrono::milliseconds(kRouterClientTimeoutMillis_);
+    int millis = std::chrono::duration_cast<std::chrono::milliseconds>(\
+            next_expire - std::chrono::steady_clock::now()).count();
+    return std::max(millis, 0);
+}
+
+void NetworkTable::Server::UpdateFanoutTopics() {
+    zmq::message_t message;
+    try {
+        fanout_socket_.recv(&message);
+    } catch(const zmq::error_t &e) {
+        if (signaled && e.num() == EINTR) {
+            throw NetworkTable::InterruptedException(e.what());
+        }
+    }
+
+    // Subscription messages are a single byte (1 for subscribe,
+    // 0 for unsubscribe) followed by the topic. The XPUB socket
+    // tells us about every subscriber to a topic but only the
+    // last one to leave, so a set is enough.
+    // Topics are uri + '\0', see NotifySubscribers.
+    if (message.size() < 2) {
+        return;
+    }
+    const char *data = static_cast<char*>(message.data());
+    std::string uri(data + 1, message.size() - 2);
+    if (data[0] == 1) {
+        fanout_topics_.insert(uri);
+
+        // The subscription is in place by the time we see it,
+        // so tell the subscriber it won't miss any updates.
+        // Other subscribers to this uri ignore the empty message.
+        zmq::message_t confirmation;
+        PublishSerializedReply(uri, &confirmation);
+    } else if (data[0] == 0) {
+        fanout_topics_.erase(uri);
+    }
+}
+
 void NetworkTable::Server::ReconnectAbandonedSockets() {
     boost::filesystem::directory_iterator end_itr;
     for (boost::filesystem::directory_iterator itr(kClients_Directory_);
@@ -193,66 +547,112 @@ void NetworkTable::Server::ReconnectAbandonedSockets() {
             socket_ptr socket = std::make_shared<zmq::socket_t>(context_, ZMQ_PAIR);
             std::string full_path_to_socket = itr->path().root_path().string() + itr->path().relative_path().string();
             socket->bind("ipc://" + full_path_to_socket);
-            sockets_.push_back(socket);
+            sockets_[socket.get()] = std::make_shared<Client>(\
+                    Client{socket, "", GetEndpoint(socket), true, 0, 0, \
+                           std::chrono::steady_clock::now()});
+            Watch(socket.get());
         }
     }
 }
 
-void NetworkTable::Server::HandleRequest(socket_ptr socket) {
-    zmq::message_t message;
-    try {
-        socket->recv(&message);
-    } catch(const zmq::error_t &e) {
-        if (signaled && e.num() == EINTR) {
-            throw NetworkTable::InterruptedException(e.what());
-        }
-    }
-
+void NetworkTable::Server::QueueRequest(client_ptr client, const zmq::message_t &message) {
     // First check to see if the client wanted to disconnect from the server.
-    if (strcmp(static_cast<char*>(message.data()), "disconnect") == 0) {
-        DisconnectSocket(socket);
+    if (MessageIs(message, "disconnect")) {
+        DisconnectClient(client);
         return;
     }
 
-    std::string serialized_request(static_cast<char*>(message.data()), \
-            message.size());
-
-    NetworkTable::Request request;
-    if (!request.ParseFromString(serialized_request)) {
+    // Parse straight out of the message's buffer.
+    auto *request = google::protobuf::Arena::CreateMessage<NetworkTable::Request>(&arena_);
+    if (!request->ParseFromArray(message.data(), message.size())) {
         std::cout << "Error parsing message\n";
         return;
     }
 
+    // Jumping ahead of this client's own normal priority
+    // requests would reorder its writes, so only requests
+    // from other clients are overtaken.
+    if (request->priority() == NetworkTable::Request::HIGH \
+            && normal_priority_clients_.count(client.get()) == 0) {
+        high_priority_requests_.emplace_back(client, request);
+    } else {
+        normal_priority_requests_.emplace_back(client, request);
+        normal_priority_clients_.insert(client.get());
+    }
+}
+
+void NetworkTable::Server::HandleQueuedRequests() {
+    for (auto *requests : {&high_priority_requests_, &normal_priority_requests_}) {
+        for (const auto &entry : *requests) {
+            // An earlier request may have been a
+            // disconnect from the same client.
+            if (entry.first->connected) {
+                HandleRequest(entry.first, *entry.second);
+            }
+        }
+        requests->clear();
+    }
+    normal_priority_clients_.clear();
+}
+
+void NetworkTable::Server::HandleRequest(client_ptr client, const NetworkTable::Request &request) {
     switch (request.type()) {
         case NetworkTable::Request::SETVALUES: {
             if (request.has_setvalues_request()) {
+                // Clients which don't want an ack number their
+                // writes instead, so we can tell if some were lost.
+                if (request.no_ack()) {
+                    CheckSequenceNumber(client, request.sequence_number());
+                }
                 SetValues(request.setvalues_request(), \
-                        socket);
-                Ack(request.id(), socket);
+                        client);
+                if (!request.no_ack()) {
+                    Ack(request.id(), client);
+                }
             }
             break;
         }
         case NetworkTable::Request::GETNODES: {
             if (request.has_getnodes_request()) {
                 GetNodes(request.getnodes_request(), \
-                       request.id(), socket);
+                       request.id(), client);
             }
             break;
         }
         case NetworkTable::Request::SUBSCRIBE: {
             if (request.has_subscribe_request()) {
-                Subscribe(request.subscribe_request(), socket);
-                Ack(request.id(), socket);
+                Subscribe(request.subscribe_request(), client);
+                Ack(request.id(), client);
             }
             break;
         }
         case NetworkTable::Request::UNSUBSCRIBE: {
             if (request.has_unsubscribe_request()) {
-                Unsubscribe(request.unsubscribe_request(), socket);
-                Ack(request.id(), socket);
+                Unsubscribe(request.unsubscribe_request(), client);
+                Ack(request.id(), client);
+            }
+            break;
+        }
+        case NetworkTable::Request::MODIFYVALUE: {
+            if (request.has_modifyvalue_request()) {
+                NetworkTable::Reply &reply = *NewReply();
+                reply.set_id(request.id());
+                std::set<std::string> uris;
+                google::protobuf::Map<std::string, NetworkTable::Value> diffs;
+                ModifyValue(request.modifyvalue_request(), &reply, &uris, &diffs);
+
+                if (!uris.empty()) {
+                    root_changed_ = true;
+                    NotifySubscribers(uris, diffs, client);
+                }
+                SendReply(reply, client);
             }
             break;
         }
+        case NetworkTable::Request::BATCH: {
+            Batch(request, client);
+            break;
+        }
         default: {
             std::cout << "Don't know how to handle request: "\
                       << request.type()\
@@ -261,31 +661,178 @@ void NetworkTable::Server::HandleRequest(socket_ptr socket) {
     }
 }
 
-void NetworkTable::Server::SetValues(const NetworkTable::SetValuesRequest &request, \
-        socket_ptr socket) {
-    std::set<std::string> uris;
-    for (auto const &entry : request.values()) {
-        std::string uri = entry.first;
-        NetworkTable::Value value = entry.second;
-        NetworkTable::SetNode(uri, value, &root_);
-
-        uris.insert(uri);
+void NetworkTable::Server::CheckSequenceNumber(client_ptr client, uint64_t sequence_number) {
+    if (sequence_number > client->last_sequence_number + 1) {
+        uint64_t num_lost = sequence_number - client->last_sequence_number - 1;
+        client->num_lost_writes += num_lost;
+        std::cout << "Lost " << num_lost << " unacked writes from " << client->endpoint \
+                  << " (" << client->num_lost_writes << " in total)" << std::endl;
     }
+    client->last_sequence_number = std::max(client->last_sequence_number, sequence_number);
+}
 
-    NetworkTable::Write(kRootFilePath_, root_);
+void NetworkTable::Server::SetValues(const NetworkTable::SetValuesRequest &request, \
+        client_ptr client) {
+    std::set<std::string> uris;
+    google::protobuf::Map<std::string, NetworkTable::Value> diffs;
+    ApplyValues(request, &uris, &diffs);
+    root_changed_ = true;
 
     // When the table has changed, make sure to
     // notify anyone who subscribed to those uris,
     // or any parent uris.
-    NotifySubscribers(uris, request.values(), socket);
+    NotifySubscribers(uris, diffs, client);
+}
+
+void NetworkTable::Server::Batch(const NetworkTable::Request &request, client_ptr client) {
+    NetworkTable::Reply &reply = *NewReply();
+    reply.set_id(request.id());
+    reply.set_type(NetworkTable::Reply::BATCH);
+
+    // Gather up everything which was set, so subscribers
+    // get one notification for the whole batch, and never
+    // see it half done.
+    std::set<std::string> uris;
+    google::protobuf::Map<std::string, NetworkTable::Value> diffs;
+
+    for (const auto &batch_request : request.batch_requests()) {
+        auto *batch_reply = reply.add_batch_replies();
+        batch_reply->set_id(batch_request.id());
+        batch_reply->set_type(NetworkTable::Reply::ACK);
+
+        switch (batch_request.type()) {
+            case NetworkTable::Request::SETVALUES: {
+                ApplyValues(batch_request.setvalues_request(), &uris, &diffs);
+                break;
+            }
+            case NetworkTable::Request::GETNODES: {
+                // Done here rather than on a reader thread,
+                // so that it sees what the batch set before it.
+                MakeGetNodesReply(batch_request.getnodes_request(), batch_request.id(), batch_reply);
+                break;
+            }
+            case NetworkTable::Request::SUBSCRIBE: {
+                Subscribe(batch_request.subscribe_request(), client);
+                break;
+            }
+            case NetworkTable::Request::UNSUBSCRIBE: {
+                Unsubscribe(batch_request.unsubscribe_request(), client);
+                break;
+            }
+            case NetworkTable::Request::MODIFYVALUE: {
+                ModifyValue(batch_request.modifyvalue_request(), batch_reply, &uris, &diffs);
+                break;
+            }
+            default: {
+                batch_reply->set_type(NetworkTable::Reply::ERROR);
+                batch_reply->mutable_error_reply()->set_type(NetworkTable::ErrorReply::BAD_REQUEST);
+                batch_reply->mutable_error_reply()->set_message_data(\
+                        "request type can't be batched: " + std::to_string(batch_request.type()));
+            }
+        }
+    }
+
+    if (!uris.empty()) {
+        root_changed_ = true;
+        NotifySubscribers(uris, diffs, client);
+    }
+
+    SendReply(reply, client);
+}
+
+void NetworkTable::Server::ModifyValue(const NetworkTable::ModifyValueRequest &request, \
+        NetworkTable::Reply *reply, std::set<std::string> *uris, \
+        google::protobuf::Map<std::string, NetworkTable::Value> *diffs) {
+    // Nodes which only have children don't have a value.
+    std::unique_ptr<NetworkTable::Value> current;
+    try {
+        NetworkTable::Node node = NetworkTable::GetNode(request.uri(), &root_);
+        if (node.has_value()) {
+            current.reset(new NetworkTable::Value(node.value()));
+        }
+    } catch (const NetworkTable::NodeNotFoundException &e) {
+    }
+
+    NetworkTable::Value new_value;
+    bool succeeded;
+    try {
+        succeeded = NetworkTable::ModifyValue(request, current.get(), &new_value);
+    } catch (const std::runtime_error &e) {
+        reply->set_type(NetworkTable::Reply::ERROR);
+        reply->mutable_error_reply()->set_type(NetworkTable::ErrorReply::BAD_REQUEST);
+        reply->mutable_error_reply()->set_message_data(e.what());
+        return;
+    }
+
+    reply->set_type(NetworkTable::Reply::MODIFYVALUE);
+    auto *modifyvalue_reply = reply->mutable_modifyvalue_reply();
+    modifyvalue_reply->set_succeeded(succeeded);
+    *modifyvalue_reply->mutable_value() = new_value;
+
+    if (succeeded) {
+        NetworkTable::SetValuesRequest setvalues_request;
+        (*setvalues_request.mutable_values())[request.uri()] = new_value;
+        ApplyValues(setvalues_request, uris, diffs);
+    }
+}
+
+void NetworkTable::Server::ApplyValues(const NetworkTable::SetValuesRequest &request, \
+        std::set<std::string> *uris, \
+        google::protobuf::Map<std::string, NetworkTable::Value> *diffs) {
+    // Reader threads may be in the middle of copying
+    // nodes out of root_, so wait for them.
+    // Reading root_ on this thread doesn't need the lock,
+    // since nobody else writes to it.
+    std::set<std::string> request_uris;
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(root_mutex_);
+        for (auto const &entry : request.values()) {
+            NetworkTable::SetNode(entry.first, entry.second, &root_);
+            request_uris.insert(entry.first);
+            (*diffs)[entry.first] = entry.second;
+        }
+    }
+    uris->insert(request_uris.begin(), request_uris.end());
+
+    // Recompute any derived values which use what was just set,
+    // and publish them alongside the values in the request.
+    auto derived = derived_values_.Update(request_uris, &root_);
+    if (!derived.empty()) {
+        std::unique_lock<std::shared_timed_mutex> lock(root_mutex_);
+        for (auto const &entry : derived) {
+            NetworkTable::SetNode(entry.first, entry.second, &root_);
+            uris->insert(entry.first);
+            (*diffs)[entry.first] = entry.second;
+        }
+    }
 }
 
 void NetworkTable::Server::GetNodes(const NetworkTable::GetNodesRequest &request, \
-            std::string id, socket_ptr socket) {
-    NetworkTable::Reply reply;
-    reply.set_id(id);
-    reply.set_type(NetworkTable::Reply::GETNODES);
-    auto *getnodes_reply = reply.mutable_getnodes_reply();
+            uint64_t id, client_ptr client) {
+    // Heartbeats (see Connection::SendHeartbeat) are empty.
+    // Answer them here, so they don't wait behind slow requests
+    // for the reader threads and make the client think we're gone.
+    if (reader_threads_.empty() || request.uris_size() == 0) {
+        NetworkTable::Reply *reply = NewReply();
+        MakeGetNodesReply(request, id, reply);
+        SendReply(*reply, client);
+        return;
+    }
+
+    // Copying and serializing big nodes is slow, so let
+    // a reader thread do it while we carry on.
+    {
+        std::lock_guard<std::mutex> lock(getnodes_queue_mutex_);
+        getnodes_queue_.push({request, id, client});
+    }
+    getnodes_queue_cv_.notify_one();
+}
+
+void NetworkTable::Server::MakeGetNodesReply(const NetworkTable::GetNodesRequest &request, \
+            uint64_t id, NetworkTable::Reply *reply) {
+    reply->set_id(id);
+    reply->set_type(NetworkTable::Reply::GETNODES);
+    auto *getnodes_reply = reply->mutable_getnodes_reply();
     auto *mutable_nodes = getnodes_reply->mutable_nodes();
 
     for (int i = 0; i < request.uris_size(); i++) {
@@ -294,59 +841,194 @@ void NetworkTable::Server::GetNodes(const NetworkTable::GetNodesRequest &request
             NetworkTable::Node node = NetworkTable::GetNode(uri, &root_);
             (*mutable_nodes)[uri] = node;
         } catch (NetworkTable::NodeNotFoundException) {
-            NetworkTable::Reply ereply;  // funny name to avoid shadowing "reply" variable
-            ereply.set_id(id);
-            ereply.set_type(NetworkTable::Reply::ERROR);
-            auto *error_reply = ereply.mutable_error_reply();
+            reply->Clear();
+            reply->set_id(id);
+            reply->set_type(NetworkTable::Reply::ERROR);
+            auto *error_reply = reply->mutable_error_reply();
+            error_reply->set_type(NetworkTable::ErrorReply::NODE_NOT_FOUND);
             error_reply->set_message_data(std::string(uri + " does not exist"));
-            SendReply(ereply, socket);
             return;
         }
     }
+}
+
+void NetworkTable::Server::ServeGetNodes() {
+    // Leave SIGINT to the main thread, so
+    // that it is the one whose poll gets interrupted.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    zmq::socket_t wakeup_socket(context_, ZMQ_PUSH);
+    wakeup_socket.setsockopt(ZMQ_LINGER, 0);
+    wakeup_socket.connect(kGetNodesRepliesEndpoint_);
+
+    // Each reader thread has its own arena, reset after every reply.
+    std::unique_ptr<char[]> arena_block(new char[kArenaBlockSize_]);
+    google::protobuf::Arena arena(ArenaOptionsWithBlock(arena_block.get(), kArenaBlockSize_));
+
+    while (true) {
+        PendingGetNodes pending;
+        {
+            std::unique_lock<std::mutex> lock(getnodes_queue_mutex_);
+            getnodes_queue_cv_.wait(lock, [this] {
+                return stop_reader_threads_ || !getnodes_queue_.empty();
+            });
+            if (stop_reader_threads_) {
+                return;
+            }
+            pending = std::move(getnodes_queue_.front());
+            getnodes_queue_.pop();
+        }
+
+        // Only hold the lock while copying out of root_,
+        // not while serializing.
+        auto *reply = google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(&arena);
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(root_mutex_);
+            MakeGetNodesReply(pending.request, pending.id, reply);
+        }
+
+        zmq::message_t serialized_reply;
+        SerializeToMessage(*reply, &serialized_reply);
+        arena.Reset();
+        {
+            std::lock_guard<std::mutex> lock(getnodes_replies_mutex_);
+            getnodes_replies_.emplace(pending.client, std::move(serialized_reply));
+        }
+
+        zmq::message_t wakeup(0);
+        wakeup_socket.send(wakeup);
+    }
+}
+
+void NetworkTable::Server::SendGetNodesReplies() {
+    zmq::message_t wakeup;
+    getnodes_replies_socket_.recv(&wakeup);
+
+    // One wakeup may be for several replies. Extra wakeups
+    // just find the queue empty.
+    std::queue<std::pair<client_ptr, zmq::message_t>> replies;
+    {
+        std::lock_guard<std::mutex> lock(getnodes_replies_mutex_);
+        std::swap(replies, getnodes_replies_);
+    }
 
-    SendReply(reply, socket);
+    while (!replies.empty()) {
+        // The client may have disconnected while
+        // its reply was being made.
+        client_ptr client = replies.front().first;
+        if (client->connected) {
+            SendSerializedReply(&replies.front().second, client);
+        }
+        replies.pop();
+    }
 }
 
 void NetworkTable::Server::Subscribe(const NetworkTable::SubscribeRequest &request, \
-            socket_ptr socket) {
-    subscriptions_table_[request.uri()].insert(socket);
+            client_ptr client) {
+    subscriptions_table_[request.uri()].insert(client);
+
+    // If the client only wants some of the fields
+    // underneath the uri, remember which ones.
+    // Subscribing again without any fields
+    // goes back to receiving the whole node.
+    if (request.fields_size() > 0) {
+        projections_table_[request.uri()][client] = \
+            std::set<std::string>(request.fields().begin(), request.fields().end());
+    } else {
+        projections_table_[request.uri()].erase(client);
+    }
+
     WriteSubscriptionTable();
 }
 
 void NetworkTable::Server::Unsubscribe(const NetworkTable::UnsubscribeRequest &request, \
-            socket_ptr socket) {
-    subscriptions_table_[request.uri()].erase(socket);
+            client_ptr client) {
+    subscriptions_table_[request.uri()].erase(client);
+    projections_table_[request.uri()].erase(client);
     WriteSubscriptionTable();
 }
 
-void NetworkTable::Server::DisconnectSocket(socket_ptr socket) {
-    // Make sure to remove any subscriptions this socket had.
+void NetworkTable::Server::DisconnectClient(client_ptr client) {
+    // Make sure to remove any subscriptions this client had.
     // Without this, the server will still try to send
-    // updates to the socket.
+    // updates to the client.
     for (auto &entry : subscriptions_table_) {
-        entry.second.erase(socket);
+        entry.second.erase(client);
     }
+    for (auto &entry : projections_table_) {
+        entry.second.erase(client);
+    }
+    shared_memory_clients_.erase(client);
+    client->connected = false;
 
     WriteSubscriptionTable();
 
-    {
-        // Remove the socket from our list of sockets to poll
-        // and delete it.
-        auto it = std::find(sockets_.begin(), sockets_.end(), socket);
-        if (it != sockets_.end()) {
-            sockets_.erase(it);
-        }
+    // Router clients don't have anything else to clean up.
+    if (!client->socket) {
+        router_clients_.erase(client->routing_id);
+        return;
     }
 
+    // Stop watching the socket, and delete it.
+    // This has to happen before it is closed, since
+    // its file descriptor could be reused.
+    Unwatch(client->socket.get());
+    sockets_.erase(client->socket.get());
+
     // Delete it from the disk to avoid reconnecting
     // in the future.
-    boost::filesystem::remove(GetEndpoint(socket));
+    boost::filesystem::remove(client->endpoint);
+}
+
+void NetworkTable::Server::ExpireDerivedValues() {
+    auto derived = derived_values_.Expire(&root_);
+    if (derived.empty()) {
+        return;
+    }
+
+    std::set<std::string> uris;
+    google::protobuf::Map<std::string, NetworkTable::Value> diffs;
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(root_mutex_);
+        for (auto const &entry : derived) {
+            NetworkTable::SetNode(entry.first, entry.second, &root_);
+            uris.insert(entry.first);
+            diffs[entry.first] = entry.second;
+        }
+    }
+
+    root_changed_ = true;
+    NotifySubscribers(uris, diffs, nullptr);
+}
+
+void NetworkTable::Server::WriteRoot(bool force) {
+    if (!root_changed_ || (!force && MillisUntilWriteRoot() > 0)) {
+        return;
+    }
+
+    NetworkTable::Write(kRootFilePath_, root_);
+    root_changed_ = false;
+    last_write_root_ = std::chrono::steady_clock::now();
+}
+
+int NetworkTable::Server::MillisUntilWriteRoot() {
+    if (!root_changed_) {
+        return -1;
+    }
+
+    auto next_write = last_write_root_ + std::chrono::milliseconds(kWriteIntervalMillis_);
+    int millis = std::chrono::duration_cast<std::chrono::milliseconds>(\
+            next_write - std::chrono::steady_clock::now()).count();
+    return std::max(millis, 0);
 }
 
 void NetworkTable::Server::NotifySubscribers(const std::set<std::string> &uris, \
         const google::protobuf::Map<std::string, NetworkTable::Value> &diffs, \
-        socket_ptr responsible_socket) {
-    std::string responsible_socket_filepath = GetEndpoint(responsible_socket);
+        client_ptr responsible_client) {
+    std::string responsible_socket_filepath = responsible_client ? responsible_client->endpoint : "";
 
     // This will contain a list of uris
     // for which the update was already sent out to.
@@ -377,80 +1059,206 @@ void NetworkTable::Server::NotifySubscribers(const std::set<std::string> &uris,
         // Now, send the reply to anybody who is subscribed to those uris
         for (const std::string &subscribed_uri : subscribed_uris) {
             if (do_not_send.find(subscribed_uri) == do_not_send.end()) {
-                NetworkTable::Reply reply;
-                reply.set_type(NetworkTable::Reply::SUBSCRIBE);
-
-                auto *subscribe_reply = reply.mutable_subscribe_reply();
+                do_not_send.insert(subscribed_uri);
 
-                auto *node = subscribe_reply->mutable_node();
-                node->CopyFrom(NetworkTable::GetNode(subscribed_uri, &root_));
+                bool has_fanout_subscribers = fanout_topics_.count(subscribed_uri) > 0;
+                auto subscription_clients = subscriptions_table_.find(subscribed_uri);
+                if (!has_fanout_subscribers && (subscription_clients == subscriptions_table_.end() \
+                        || subscription_clients->second.empty())) {
+                    // Nobody is subscribed, so don't bother
+                    // copying the node into a reply.
+                    continue;
+                }
 
-                subscribe_reply->set_uri(subscribed_uri);
-                subscribe_reply->set_responsible_socket(responsible_socket_filepath);
-                auto reply_diffs = subscribe_reply->mutable_diffs();
-                for (auto const &diff : diffs) {
-                    (*reply_diffs)[diff.first] = diff.second;
+                // Split the clients into ones which want the whole node,
+                // and ones which only want some fields of it.
+                std::set<client_ptr> whole_node_clients;
+                std::map<std::set<std::string>, std::set<client_ptr>> projected_clients;
+                auto projections = projections_table_.find(subscribed_uri);
+                if (subscription_clients != subscriptions_table_.end()) {
+                    for (const auto& client : subscription_clients->second) {
+                        if (projections != projections_table_.end() \
+                                && projections->second.count(client) > 0) {
+                            projected_clients[projections->second.at(client)].insert(client);
+                        } else {
+                            whole_node_clients.insert(client);
+                        }
+                    }
                 }
 
-                std::set<socket_ptr> subscription_sockets = subscriptions_table_[subscribed_uri];
-                // Do the serialization here, not in the for loop
-                std::string serialized_reply;
-                reply.SerializeToString(&serialized_reply);
-                for (const auto& socket : subscription_sockets) {
-                    SendSerializedReply(serialized_reply, socket);
+                if (!whole_node_clients.empty() || has_fanout_subscribers) {
+                    NetworkTable::Reply &reply = *NewReply();
+                    reply.set_type(NetworkTable::Reply::SUBSCRIBE);
+
+                    auto *subscribe_reply = reply.mutable_subscribe_reply();
+
+                    auto *node = subscribe_reply->mutable_node();
+                    node->CopyFrom(NetworkTable::GetNode(subscribed_uri, &root_));
+
+                    subscribe_reply->set_uri(subscribed_uri);
+                    subscribe_reply->set_responsible_socket(responsible_socket_filepath);
+                    auto reply_diffs = subscribe_reply->mutable_diffs();
+                    for (auto const &diff : diffs) {
+                        (*reply_diffs)[diff.first] = diff.second;
+                    }
+
+                    // Do the serialization here, not in the for loop.
+                    // Every send below shares this one buffer.
+                    zmq::message_t serialized_reply;
+                    SerializeToMessage(reply, &serialized_reply);
+
+                    // Clients reading from shared memory all get
+                    // it from a single write. If it doesn't fit,
+                    // they get it on their socket like everyone else.
+                    bool written_to_shared_memory = false;
+                    for (const auto& client : whole_node_clients) {
+                        if (shared_memory_clients_.count(client) > 0) {
+                            written_to_shared_memory = \
+                                notification_ring_.Write(subscribed_uri, \
+                                        serialized_reply.data(), serialized_reply.size());
+                            break;
+                        }
+                    }
+
+                    for (const auto& client : whole_node_clients) {
+                        if (written_to_shared_memory && shared_memory_clients_.count(client) > 0) {
+                            continue;
+                        }
+                        SendSerializedReply(&serialized_reply, client);
+                    }
+
+                    // A single send reaches every fan-out subscriber.
+                    if (has_fanout_subscribers) {
+                        PublishSerializedReply(subscribed_uri, &serialized_reply);
+                    }
                 }
 
-                do_not_send.insert(subscribed_uri);
+                // Clients with the same projection share a single reply.
+                for (const auto &entry : projected_clients) {
+                    const std::set<std::string> &fields = entry.first;
+
+                    NetworkTable::Reply &reply = *NewReply();
+                    reply.set_type(NetworkTable::Reply::SUBSCRIBE);
+
+                    auto *subscribe_reply = reply.mutable_subscribe_reply();
+                    auto reply_diffs = subscribe_reply->mutable_diffs();
+                    for (auto const &diff : diffs) {
+                        for (const std::string &field : fields) {
+                            if (NetworkTable::IsDescendant(diff.first, subscribed_uri + "/" + field)) {
+                                (*reply_diffs)[diff.first] = diff.second;
+                                break;
+                            }
+                        }
+                    }
+
+                    // None of the fields they care about changed.
+                    if (reply_diffs->empty()) {
+                        continue;
+                    }
+
+                    auto *node = subscribe_reply->mutable_node();
+                    node->CopyFrom(NetworkTable::GetProjectedNode(subscribed_uri, fields, &root_));
+
+                    subscribe_reply->set_uri(subscribed_uri);
+                    subscribe_reply->set_responsible_socket(responsible_socket_filepath);
+
+                    zmq::message_t serialized_reply;
+                    SerializeToMessage(reply, &serialized_reply);
+                    for (const auto& client : entry.second) {
+                        SendSerializedReply(&serialized_reply, client);
+                    }
+                }
             }
         }
     }
 }
 
-void NetworkTable::Server::SendReply(const NetworkTable::Reply &reply, socket_ptr socket) {
-    std::string serialized_reply;
-    reply.SerializeToString(&serialized_reply);
+void NetworkTable::Server::SendReply(const NetworkTable::Reply &reply, client_ptr client) {
+    zmq::message_t serialized_reply;
+    SerializeToMessage(reply, &serialized_reply);
+
+    SendSerializedReply(&serialized_reply, client);
+}
 
-    SendSerializedReply(serialized_reply, socket);
+void NetworkTable::Server::SerializeToMessage(const NetworkTable::Reply &reply, zmq::message_t *message) {
+    message->rebuild(reply.ByteSizeLong());
+    reply.SerializeWithCachedSizesToArray(static_cast<uint8_t*>(message->data()));
 }
 
-void NetworkTable::Server::SendSerializedReply(const std::string &serialized_reply, socket_ptr socket) {
-    zmq::message_t message(serialized_reply.length());
-    memcpy(message.data(), serialized_reply.data(), serialized_reply.length());
+void NetworkTable::Server::SendSerializedReply(zmq::message_t *serialized_reply, client_ptr client) {
+    // Large messages are reference counted, so
+    // this shares the buffer instead of copying it.
+    zmq::message_t message;
+    message.copy(serialized_reply);
+
+    // Router clients are addressed by putting
+    // their routing id in front of the message.
+    zmq::socket_t *socket = client->socket ? client->socket.get() : &router_socket_;
     try {
-        socket->send(message, ZMQ_DONTWAIT);
+        bool sent_routing_id = true;
+        if (!client->socket) {
+            zmq::message_t routing_id(client->routing_id.data(), client->routing_id.size());
+            sent_routing_id = socket->send(routing_id, ZMQ_SNDMORE | ZMQ_DONTWAIT);
+        }
+        if (sent_routing_id) {
+            socket->send(message, ZMQ_DONTWAIT);
+        }
     } catch(const zmq::error_t &e) {
         if (signaled && e.num() == EINTR) {
             throw NetworkTable::InterruptedException(e.what());
         }
+        // The client's connection is gone. It can't be
+        // disconnected here, since we may be going through
+        // its subscriptions.
+        if (e.num() == EHOSTUNREACH && !client->socket) {
+            unreachable_router_clients_.insert(client);
+        }
     }
-}
 
-void NetworkTable::Server::Ack(const std::string &id, socket_ptr socket) {
-    NetworkTable::Reply reply;
-    reply.set_type(NetworkTable::Reply::ACK);
-    reply.set_id(id);
+    // Sending may have swallowed the signal
+    // for a message waiting to be received.
+    ready_sockets_.insert(socket);
+}
 
-    std::string serialized_reply;
-    reply.SerializeToString(&serialized_reply);
+void NetworkTable::Server::PublishSerializedReply(const std::string &uri, \
+        zmq::message_t *serialized_reply) {
+    // The topic is terminated with a null character,
+    // so that subscribers to "gps_0" don't also get "gps_01".
+    zmq::message_t topic(uri.size() + 1);
+    memcpy(topic.data(), uri.c_str(), uri.size() + 1);
 
-    zmq::message_t message(serialized_reply.length());
-    memcpy(message.data(), serialized_reply.data(), serialized_reply.length());
+    zmq::message_t message;
+    message.copy(serialized_reply);
     try {
-        socket->send(message, ZMQ_DONTWAIT);
+        fanout_socket_.send(topic, ZMQ_SNDMORE | ZMQ_DONTWAIT);
+        fanout_socket_.send(message, ZMQ_DONTWAIT);
     } catch(const zmq::error_t &e) {
         if (signaled && e.num() == EINTR) {
             throw NetworkTable::InterruptedException(e.what());
         }
     }
+    ready_sockets_.insert(&fanout_socket_);
+}
+
+void NetworkTable::Server::Ack(uint64_t id, client_ptr client) {
+    NetworkTable::Reply *reply = NewReply();
+    reply->set_type(NetworkTable::Reply::ACK);
+    reply->set_id(id);
+
+    SendReply(*reply, client);
+}
+
+NetworkTable::Reply *NetworkTable::Server::NewReply() {
+    return google::protobuf::Arena::CreateMessage<NetworkTable::Reply>(&arena_);
 }
 
 void NetworkTable::Server::WriteSubscriptionTable() {
     std::map<std::string, std::set<std::string>> simple_subscription_table;
     for (auto const& entry : subscriptions_table_) {
         auto uri = entry.first;
-        auto subscription_sockets = entry.second;
-        for (auto const& socket : subscription_sockets) {
-            simple_subscription_table[uri].insert(GetEndpoint(socket));
+        auto subscription_clients = entry.second;
+        for (auto const& client : subscription_clients) {
+            simple_subscription_table[uri].insert(client->endpoint);
         }
     }
 
@@ -508,9 +1316,16 @@ void NetworkTable::Server::LoadSubscriptionTable() {
         auto uri = entry.first;
         auto subscription_socket_endpoints = entry.second;
         for (auto const& endpoint : subscription_socket_endpoints) {
-            for (auto const& socket : sockets_) {
-                if (GetEndpoint(socket) == endpoint) {
-                    subscriptions_table_[uri].insert(socket);
+            // Router clients reconnect by themselves, with the same
+            // routing id, so they can be added back straight away.
+            if (boost::starts_with(endpoint, kRouterEndpointPrefix_)) {
+                subscriptions_table_[uri].insert(\
+                        GetRouterClient(endpoint.substr(kRouterEndpointPrefix_.size())));
+                continue;
+            }
+            for (auto const& client : sockets_) {
+                if (client.second->endpoint == endpoint) {
+                    subscriptions_table_[uri].insert(client.second);
                 }
             }
         }
@@ -3,16 +3,30 @@
 #ifndef SERVER_H_
 #define SERVER_H_
 
+#include <google/protobuf/arena.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <set>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <zmq.hpp>
 
+#include "DerivedValues.h"
 #include "GetNodesRequest.pb.h"
+#include "ModifyValueRequest.pb.h"
 #include "Reply.pb.h"
+#include "Request.pb.h"
 #include "SetValuesRequest.pb.h"
+#include "SharedMemoryRing.h"
 #include "SubscribeRequest.pb.h"
 #include "UnsubscribeRequest.pb.h"
 #include "Help.h"
@@ -22,8 +36,41 @@ namespace NetworkTable {
 class Server {
 typedef std::shared_ptr<zmq::socket_t> socket_ptr;
 
+/*
+ * A connected client process. Pair clients have their own
+ * ZMQ_PAIR socket, router clients share router_socket_
+ * and are told apart by their routing id.
+ */
+struct Client {
+    socket_ptr socket;  // Null for router clients.
+    std::string routing_id;  // Empty for pair clients.
+    std::string endpoint;  // Identifies the client in subscribe replies
+                           // and in the saved subscription table.
+    bool connected;
+    uint64_t last_sequence_number;  // Of the last unacked write (see Connection::Publish).
+    uint64_t num_lost_writes;  // Unacked writes which never arrived.
+    std::chrono::steady_clock::time_point last_seen;  // When a router client last sent
+                                                      // anything, or was loaded from disk.
+};
+typedef std::shared_ptr<Client> client_ptr;
+
  public:
-    Server();
+    /*
+     * @param directory - where the server's sockets go, and where
+     *                    root_ and the subscription table are saved.
+     *                    Must end in '/'. Clients must connect with
+     *                    the same directory (see Connection()).
+     * @param shared_memory_name - the shared memory which subscribe
+     *                             replies are written to, see
+     *                             Connection::EnableSharedMemory.
+     */
+    explicit Server(const std::string &directory = "/tmp/sailbot/", \
+            const std::string &shared_memory_name = "/sailbot_network_table");
+
+    /*
+     * Stops the GetNodes reader threads.
+     */
+    ~Server();
 
     /*
      * Starts the network table, which will then be able
@@ -31,7 +78,61 @@ typedef std::shared_ptr<zmq::socket_t> socket_ptr;
      */
     void Run();
 
+    /*
+     * Loads the declarations of values which the server
+     * computes from other values (see DerivedValues.h).
+     * Must be called before Run.
+     * @throws - std::runtime_error if the file can't be parsed.
+     */
+    void LoadDerivedValues(const std::string &filepath);
+
+    /*
+     * Sets how many threads serve GetNodes requests,
+     * so that large gets don't hold up everything else.
+     * With 0, GetNodes is handled on the same thread as
+     * everything else. Must be called before Run.
+     */
+    void SetNumReaderThreads(int num_reader_threads);
+
+    /*
+     * Also accept connections from other hosts over TCP.
+     * Clients connect to port like they would to the router
+     * socket (see Connection::EnableTcp), and fan-out
+     * subscribers to port + 1, so both ports must be free.
+     * Shared memory is only for clients on this host,
+     * so TCP clients never use it. There is no authentication,
+     * so only bind to an interface on a trusted network.
+     * Must be called before Run.
+     * @param address - ip address of the interface to bind to,
+     *                  ex. "10.0.0.8", or "*" for all interfaces.
+     * @throws - zmq::error_t if the ports can't be bound.
+     */
+    void ListenOnTcp(const std::string &address, int port);
+
  private:
+    /*
+     * A GetNodes request waiting for a reader thread.
+     */
+    struct PendingGetNodes {
+        NetworkTable::GetNodesRequest request;
+        uint64_t id;
+        client_ptr client;
+    };
+
+    /*
+     * Starts/stops waking up Run when socket has something to read.
+     * Each socket is registered once, instead of being
+     * handed to zmq::poll on every loop.
+     */
+    void Watch(zmq::socket_t *socket);
+    void Unwatch(zmq::socket_t *socket);
+
+    /*
+     * Receives and handles one message from socket,
+     * if it has any. Returns true if it did.
+     */
+    bool HandleReadySocket(zmq::socket_t *socket);
+
     /*
      * Creates a new ZMQ_PAIR socket,
      * and returns its location to the client
@@ -39,6 +140,54 @@ typedef std::shared_ptr<zmq::socket_t> socket_ptr;
      */
     void CreateNewConnection();
 
+    /*
+     * Receives messages from router_socket_ until it is empty,
+     * kMaxRouterMessagesPerLoop_ have been received, or a client
+     * has sent kMaxRouterMessagesPerClient_ this loop. ZMQ takes
+     * turns between clients, so by then every other client has
+     * had the same chance. The message which went over the
+     * limit is kept for the next loop.
+     * @return - true if there may be more messages waiting.
+     */
+    bool HandleRouterMessages();
+
+    /*
+     * Handles a message from a router client. Connect requests
+     * are replied to with the client's endpoint, anything else
+     * is handled like a request on a ZMQ_PAIR socket.
+     */
+    void HandleRouterMessage(zmq::message_t *routing_id, const zmq::message_t &message);
+
+    /*
+     * Returns the router client with the given routing id,
+     * adding it if it hasn't been seen before (eg. because
+     * the server restarted while the client was connected).
+     */
+    client_ptr GetRouterClient(const std::string &routing_id);
+
+    /*
+     * Disconnects router clients which have gone away without
+     * saying so (eg. they crashed). ZMQ doesn't tell us when that
+     * happens, but sending to them fails, so clients which have been
+     * quiet for kRouterClientTimeoutMillis_ are sent an empty ack
+     * every so often. Clients which sent something recently are
+     * left alone, since they may just be reconnecting.
+     */
+    void ExpireRouterClients();
+
+    /*
+     * How long until ExpireRouterClients has something to do,
+     * or -1 if there are no router clients.
+     */
+    int MillisUntilExpireRouterClients();
+
+    /*
+     * Receives a subscribe/unsubscribe message
+     * from the fan-out socket, updates fanout_topics_,
+     * and confirms new subscriptions to their subscriber.
+     */
+    void UpdateFanoutTopics();
+
     /*
      * If there are any abandoned client sockets,
      * this function will get the server to connect to them.
@@ -47,29 +196,115 @@ typedef std::shared_ptr<zmq::socket_t> socket_ptr;
     void ReconnectAbandonedSockets();
 
     /*
-     * Handles a request on a ZMQ_PAIR socket.
+     * Parses a message from a client, and queues it to be
+     * handled later in this loop (see HandleQueuedRequests).
+     * Disconnects are handled right away.
+     */
+    void QueueRequest(client_ptr client, const zmq::message_t &message);
+
+    /*
+     * Handles every request queued this loop, high priority
+     * ones first. Their replies and notifications go out before
+     * any normal priority request is even looked at.
+     * A single client's requests are still handled in the order
+     * it sent them: once it has a normal priority request queued,
+     * its high priority ones queue behind it (see QueueRequest).
+     */
+    void HandleQueuedRequests();
+
+    /*
+     * Handles a request from a client.
+     */
+    void HandleRequest(client_ptr client, const NetworkTable::Request &request);
+
+    /*
+     * Unacked writes are numbered 1, 2, 3... per client, so
+     * a gap in sequence_number means some were dropped.
+     * Counts and logs them.
      */
-    void HandleRequest(socket_ptr socket);
+    void CheckSequenceNumber(client_ptr client, uint64_t sequence_number);
+
+    /*
+     * Saves root_ to disk if it changed, and it's been at least
+     * kWriteIntervalMillis_ since it was last saved (or if force).
+     * Writing the whole table is slow, so it isn't done per request.
+     */
+    void WriteRoot(bool force);
+
+    /*
+     * How long until WriteRoot has something to do,
+     * or -1 if root_ hasn't changed.
+     */
+    int MillisUntilWriteRoot();
 
     /*
      * Helper functions to handle specific types
      * of requests. Some of these requests
      * must send back a reply, so the helper function
-     * also needs a socket to send the reply to.
+     * also needs a client to send the reply to.
      */
     void SetValues(const NetworkTable::SetValuesRequest &request, \
-            socket_ptr socket);
+            client_ptr client);
+
+    /*
+     * Handles each request in a batch in order, and sends back
+     * a single reply containing the reply to each of them.
+     * Values set by the batch are saved and sent to subscribers
+     * once, after the whole batch is done.
+     */
+    void Batch(const NetworkTable::Request &request, client_ptr client);
+
+    /*
+     * Does a compare and set, increment or append on a value,
+     * and fills in reply with whether it worked and the value
+     * which is now there. Nothing can change the value in between
+     * reading and setting it, since requests are handled one at a time.
+     * Like ApplyValues, the caller saves root_ and notifies subscribers.
+     */
+    void ModifyValue(const NetworkTable::ModifyValueRequest &request, \
+            NetworkTable::Reply *reply, std::set<std::string> *uris, \
+            google::protobuf::Map<std::string, NetworkTable::Value> *diffs);
+
+    /*
+     * Sets the values in root_, along with any derived values
+     * which depend on them. Adds every uri which was set to uris,
+     * and its new value to diffs. Doesn't save root_ or notify anyone.
+     */
+    void ApplyValues(const NetworkTable::SetValuesRequest &request, \
+            std::set<std::string> *uris, \
+            google::protobuf::Map<std::string, NetworkTable::Value> *diffs);
 
     void GetNodes(const NetworkTable::GetNodesRequest &request, \
-            std::string id, socket_ptr socket);
+            uint64_t id, client_ptr client);
+
+    /*
+     * Fills in the reply to a GetNodes request, which is
+     * an error reply if any of the nodes don't exist.
+     * Only reads root_, so it is safe to call from reader threads
+     * while holding a shared lock on root_mutex_.
+     */
+    void MakeGetNodesReply(const NetworkTable::GetNodesRequest &request, \
+            uint64_t id, NetworkTable::Reply *reply);
+
+    /*
+     * Runs in each reader thread. Takes requests off getnodes_queue_,
+     * and hands the serialized replies back to the thread running Run,
+     * since only it may use the client sockets.
+     */
+    void ServeGetNodes();
+
+    /*
+     * Sends the replies which reader threads have finished.
+     */
+    void SendGetNodesReplies();
 
     void Subscribe(const NetworkTable::SubscribeRequest &request, \
-            socket_ptr socket);
+            client_ptr client);
 
     void Unsubscribe(const NetworkTable::UnsubscribeRequest &request, \
-            socket_ptr socket);
+            client_ptr client);
 
-    void DisconnectSocket(socket_ptr socket);
+    void DisconnectClient(client_ptr client);
 
     /*
      * Sets a value stored in root_ if it exists, creates
@@ -79,31 +314,59 @@ typedef std::shared_ptr<zmq::socket_t> socket_ptr;
     void SetValueInTable(std::string key, const NetworkTable::Value &value);
 
     /*
-     * Gets any sockets which have subscribed to key, and sends value to them.
-     * Also include who caused this notify.
+     * Sets any stale() derived values which have
+     * expired, and notifies their subscribers.
+     */
+    void ExpireDerivedValues();
+
+    /*
+     * Gets any clients which have subscribed to key, and sends value to them.
+     * Also include who caused this notify. responsible_client
+     * is null if the server made the change itself.
      */
     void NotifySubscribers(const std::set<std::string> &uris, \
             const google::protobuf::Map<std::string, NetworkTable::Value> &diffs, \
-            socket_ptr responsible_socket);
+            client_ptr responsible_client);
 
     /*
      * Serializes a network table reply,
-     * then sends it on the socket.
+     * then sends it to the client.
+     */
+    void SendReply(const NetworkTable::Reply &reply, client_ptr client);
+
+    /*
+     * Serializes reply straight into message's buffer,
+     * without going through a std::string.
      */
-    void SendReply(const NetworkTable::Reply &reply, socket_ptr socket);
+    static void SerializeToMessage(const NetworkTable::Reply &reply, zmq::message_t *message);
 
     /*
      * Sends an already serialized reply.
      * If you are sending a single reply to many sockets, you can
-     * avoid unnecessary serialization.
+     * avoid unnecessary serialization. message is not used up:
+     * each send shares its buffer instead of copying it.
      */
-    void SendSerializedReply(const std::string &serialized_reply, socket_ptr socket);
+    void SendSerializedReply(zmq::message_t *message, client_ptr client);
+
+    /*
+     * Sends an already serialized subscribe reply
+     * once on the fan-out socket, to every client
+     * which subscribed to uri through it.
+     */
+    void PublishSerializedReply(const std::string &uri, zmq::message_t *message);
 
     /*
      * Sends an ack reply,
      * so the client knows its request was recieved.
      */
-    void Ack(const std::string &id, socket_ptr socket);
+    void Ack(uint64_t id, client_ptr client);
+
+    /*
+     * Makes an empty reply on arena_. It is freed at the end
+     * of the current loop in Run, so don't hold on to it.
+     * Only call this from Run's thread.
+     */
+    NetworkTable::Reply *NewReply();
 
     /*
      * Save subscription table to disk.
@@ -122,17 +385,106 @@ typedef std::shared_ptr<zmq::socket_t> socket_ptr;
 
     zmq::context_t context_;  // The context which sockets are created from.
     zmq::socket_t welcome_socket_;  // Used to connect to the server for the first time.
-    std::vector<socket_ptr> sockets_;  // Each socket is a connection to another process.
+    zmq::socket_t router_socket_;  // Clients which connect here share this one socket,
+                                   // instead of getting their own ZMQ_PAIR socket.
+    zmq::socket_t fanout_socket_;  // Publishes subscribe replies to clients which
+                                   // subscribed through ZMQ instead of a request.
+    std::set<std::string> fanout_topics_;  // uris which have at least one fan-out subscriber.
+    NetworkTable::SharedMemoryRing notification_ring_;  // Subscribe replies for clients on this host.
+    std::set<client_ptr> shared_memory_clients_;  // Clients which read subscribe replies
+                                                  // from notification_ring_ instead of their socket.
+    std::unordered_map<zmq::socket_t*, client_ptr> sockets_;  // Each socket is a connection to
+                                                              // another process.
+    std::unordered_map<std::string, client_ptr> router_clients_;  // maps from routing id to
+                                                                  // clients of router_socket_.
+    std::set<client_ptr> unreachable_router_clients_;  // Sending to these failed this loop.
+    std::chrono::steady_clock::time_point last_expire_router_clients_;
+    bool has_deferred_router_message_;  // See HandleRouterMessages.
+    zmq::message_t deferred_routing_id_;
+    zmq::message_t deferred_router_message_;
+    int epoll_fd_;  // Watches the ZMQ_FD of every socket we receive on.
+    std::set<zmq::socket_t*> ready_sockets_;  // Sockets which may have messages waiting.
+                                              // ZMQ_FD only signals when new messages arrive,
+                                              // and sending can swallow that signal, so sockets
+                                              // stay in here until ZMQ_EVENTS says they're empty.
     NetworkTable::Node root_;  // This is where the actual data is stored.
+    bool root_changed_;  // True if root_ changed since it was last written to disk.
+    std::chrono::steady_clock::time_point last_write_root_;
+    std::vector<std::pair<client_ptr, \
+        const NetworkTable::Request*>> high_priority_requests_;  // Parsed this loop, on arena_.
+    std::vector<std::pair<client_ptr, \
+        const NetworkTable::Request*>> normal_priority_requests_;
+    std::set<Client*> normal_priority_clients_;  // Clients with a request in normal_priority_requests_.
+    std::shared_timed_mutex root_mutex_;  // Reader threads hold this shared while reading root_.
+                                          // Run's thread is the only writer, and holds it
+                                          // exclusively while modifying root_.
+
+    int num_reader_threads_;
+    std::vector<std::thread> reader_threads_;  // Serve GetNodes requests.
+    bool stop_reader_threads_;  // Guarded by getnodes_queue_mutex_.
+    std::mutex getnodes_queue_mutex_;
+    std::condition_variable getnodes_queue_cv_;
+    std::queue<PendingGetNodes> getnodes_queue_;  // Waiting for a reader thread.
+    std::mutex getnodes_replies_mutex_;
+    std::queue<std::pair<client_ptr, zmq::message_t>> getnodes_replies_;  // Serialized replies
+                                                                          // waiting to be sent.
+    zmq::socket_t getnodes_replies_socket_;  // Reader threads send a message here when
+                                             // they add to getnodes_replies_, to wake up Run.
+    std::unique_ptr<char[]> arena_block_;  // First block of arena_. Resetting the arena
+                                           // keeps it, so quiet loops don't allocate at all.
+    google::protobuf::Arena arena_;  // Requests and replies made on Run's thread. Everything
+                                     // in it is freed at once at the end of each loop.
+    NetworkTable::DerivedValues derived_values_;  // Values computed from other values in root_.
+    std::unordered_map<std::string, \
+        std::set<client_ptr>> subscriptions_table_;  // maps from a key in the network table
+                                                      // to a set of clients subscribe to that key.
     std::unordered_map<std::string, \
-        std::set<socket_ptr>> subscriptions_table_;  // maps from a key in the network table
-                                                      // to a set of sockets subscribe to that key.
+        std::map<client_ptr, std::set<std::string>>> projections_table_;  // maps from a subscribed key
+                                                                           // to the fields each client
+                                                                           // wants. Clients which aren't
+                                                                           // in here get the whole node.
 
-    // location of welcoming socket
-    const std::string kWelcome_Directory_ = "/tmp/sailbot/";  // NOLINT(runtime/string)
+    // location of welcoming socket, see Server()
+    const std::string kWelcome_Directory_;
 
     const std::string kClients_Directory_ = kWelcome_Directory_ + "clients/";  // NOLINT(runtime/string)
 
+    // endpoints of router clients start with this, followed by their routing id
+    const std::string kRouterEndpointPrefix_ = "router:";  // NOLINT(runtime/string)
+
+    // where reader threads wake up the main thread
+    const std::string kGetNodesRepliesEndpoint_ = "inproc://getnodes_replies";  // NOLINT(runtime/string)
+
+    static const int kDefaultNumReaderThreads_ = 2;
+
+    // most sockets handled per wakeup
+    static const int kMaxEpollEvents_ = 64;
+
+    // most router messages received per loop, in total and from each
+    // client, so requests from several clients are sorted by priority
+    // together, and a busy client can't crowd out the others
+    static const int kMaxRouterMessagesPerLoop_ = 256;
+    static const int kMaxRouterMessagesPerClient_ = 16;
+
+    // how long a router client can be quiet before we check it's still there
+    static const int kRouterClientTimeoutMillis_ = 10000;
+
+    // ZMTP heartbeats on the router socket, so connections to
+    // remote clients which silently drop get closed
+    static const int kRouterHeartbeatIntervalMillis_ = 1000;
+    static const int kRouterHeartbeatTimeoutMillis_ = 5000;
+
+    // least time between writes of root_ to disk
+    static const int kWriteIntervalMillis_ = 100;
+
+    // size of the first block of each arena, big enough
+    // for a loop's worth of small requests and replies
+    static const size_t kArenaBlockSize_ = 64 * 1024;
+
+    // shared memory which subscribe replies are written to
+    const std::string kSharedMemoryName_;
+    const uint64_t kSharedMemoryCapacity_ = 4 * 1024 * 1024;
+
     // where root_ is saved (in case of crash)
     const std::string kRootFilePath_ = kWelcome_Directory_ + "root_.txt";  // NOLINT(runtime/string)
 
@@ -0,0 +1,213 @@
+// Copyright 2017 UBC Sailbot
+
+#include "SharedMemoryRing.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+// The header is shared between processes,
+// so its atomics must not rely on a lock.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, \
+        "shared memory ring needs lock free atomics");
+
+// Each message is stored as:
+// [topic size (4 bytes)][body size (4 bytes)][topic][body]
+// padded to a multiple of 8 bytes.
+const uint64_t kMessageHeaderSize = 8;
+
+static uint64_t PaddedMessageSize(uint64_t topic_size, uint64_t body_size) {
+    return (kMessageHeaderSize + topic_size + body_size + 7) & ~static_cast<uint64_t>(7);
+}
+
+NetworkTable::SharedMemoryRing::SharedMemoryRing()
+    : is_writer_(false), header_(nullptr), buffer_(nullptr),
+      mapped_size_(0), read_position_(0) {
+}
+
+NetworkTable::SharedMemoryRing::~SharedMemoryRing() {
+    Close();
+}
+
+void NetworkTable::SharedMemoryRing::Create(const std::string &name, uint64_t capacity) {
+    Close();
+
+    // Start from scratch, in case an old writer crashed
+    // and left the shared memory behind.
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1) {
+        throw std::runtime_error("failed to create shared memory " + name + ": " + strerror(errno));
+    }
+
+    uint64_t mapped_size = sizeof(Header) + capacity;
+    if (ftruncate(fd, mapped_size) == -1) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("failed to size shared memory " + name + ": " + strerror(errno));
+    }
+
+    void *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("failed to map shared memory " + name + ": " + strerror(errno));
+    }
+
+    header_ = new (memory) Header();
+    header_->reserved = 0;
+    header_->committed = 0;
+    header_->futex = 0;
+    header_->waiters = 0;
+    header_->capacity = capacity;
+    buffer_ = static_cast<char*>(memory) + sizeof(Header);
+    mapped_size_ = mapped_size;
+    name_ = name;
+    is_writer_ = true;
+}
+
+void NetworkTable::SharedMemoryRing::Open(const std::string &name) {
+    Close();
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        throw std::runtime_error("failed to open shared memory " + name + ": " + strerror(errno));
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || static_cast<uint64_t>(info.st_size) < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error("shared memory " + name + " is not initialized");
+    }
+
+    // Readers need write access too, to sleep on the futex.
+    void *memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("failed to map shared memory " + name + ": " + strerror(errno));
+    }
+
+    header_ = static_cast<Header*>(memory);
+    buffer_ = static_cast<char*>(memory) + sizeof(Header);
+    mapped_size_ = info.st_size;
+    name_ = name;
+    is_writer_ = false;
+    read_position_ = header_->committed.load();
+}
+
+bool NetworkTable::SharedMemoryRing::IsOpen() const {
+    return header_ != nullptr;
+}
+
+bool NetworkTable::SharedMemoryRing::Write(const std::string &topic, const std::string &body) {
+    return Write(topic, body.data(), body.size());
+}
+
+bool NetworkTable::SharedMemoryRing::Write(const std::string &topic, const void *body, uint64_t body_size) {
+    uint64_t message_size = PaddedMessageSize(topic.size(), body_size);
+    if (message_size > header_->capacity / 2) {
+        return false;
+    }
+
+    // Mark the space as being written before touching it, so
+    // a reader who was copying from it can tell (see Read).
+    uint64_t position = header_->committed.load(std::memory_order_relaxed);
+    header_->reserved.store(position + message_size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t sizes[2] = {static_cast<uint32_t>(topic.size()), static_cast<uint32_t>(body_size)};
+    CopyIn(position, sizes, kMessageHeaderSize);
+    CopyIn(position + kMessageHeaderSize, topic.data(), topic.size());
+    CopyIn(position + kMessageHeaderSize + topic.size(), body, body_size);
+
+    header_->committed.store(position + message_size);
+
+    // Only make the syscall if someone is actually asleep.
+    if (header_->waiters.load() > 0) {
+        header_->futex.fetch_add(1);
+        syscall(SYS_futex, &header_->futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+    return true;
+}
+
+NetworkTable::SharedMemoryRing::ReadResult NetworkTable::SharedMemoryRing::Read(\
+        std::string *topic, std::string *body) {
+    uint64_t committed = header_->committed.load(std::memory_order_acquire);
+    if (committed == read_position_) {
+        return EMPTY;
+    }
+    if (committed - read_position_ > header_->capacity) {
+        read_position_ = committed;
+        return OVERRUN;
+    }
+
+    uint32_t sizes[2];
+    CopyOut(read_position_, sizes, kMessageHeaderSize);
+    uint64_t message_size = PaddedMessageSize(sizes[0], sizes[1]);
+    if (message_size <= header_->capacity / 2) {
+        topic->resize(sizes[0]);
+        body->resize(sizes[1]);
+        CopyOut(read_position_ + kMessageHeaderSize, &(*topic)[0], sizes[0]);
+        CopyOut(read_position_ + kMessageHeaderSize + sizes[0], &(*body)[0], sizes[1]);
+    }
+
+    // If the writer started overwriting what we just copied,
+    // the copy can't be trusted.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t reserved = header_->reserved.load(std::memory_order_relaxed);
+    if (reserved - read_position_ > header_->capacity || message_size > header_->capacity / 2) {
+        read_position_ = header_->committed.load(std::memory_order_acquire);
+        return OVERRUN;
+    }
+
+    read_position_ += message_size;
+    return MESSAGE;
+}
+
+void NetworkTable::SharedMemoryRing::Wait(int timeout_millis) {
+    header_->waiters.fetch_add(1);
+    uint32_t futex = header_->futex.load();
+    if (header_->committed.load() == read_position_) {
+        struct timespec timeout;
+        timeout.tv_sec = timeout_millis / 1000;
+        timeout.tv_nsec = (timeout_millis % 1000) * 1000000L;
+        syscall(SYS_futex, &header_->futex, FUTEX_WAIT, futex, &timeout, nullptr, 0);
+    }
+    header_->waiters.fetch_sub(1);
+}
+
+void NetworkTable::SharedMemoryRing::CopyIn(uint64_t position, const void *data, uint64_t size) {
+    uint64_t offset = position % header_->capacity;
+    uint64_t first_part = std::min(size, header_->capacity - offset);
+    memcpy(buffer_ + offset, data, first_part);
+    memcpy(buffer_, static_cast<const char*>(data) + first_part, size - first_part);
+}
+
+void NetworkTable::SharedMemoryRing::CopyOut(uint64_t position, void *data, uint64_t size) const {
+    uint64_t offset = position % header_->capacity;
+    uint64_t first_part = std::min(size, header_->capacity - offset);
+    memcpy(data, buffer_ + offset, first_part);
+    memcpy(static_cast<char*>(data) + first_part, buffer_, size - first_part);
+}
+
+void NetworkTable::SharedMemoryRing::Close() {
+    if (header_ == nullptr) {
+        return;
+    }
+
+    munmap(header_, mapped_size_);
+    if (is_writer_) {
+        shm_unlink(name_.c_str());
+    }
+    header_ = nullptr;
+    buffer_ = nullptr;
+}
@@ -0,0 +1,99 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef SHAREDMEMORYRING_H_
+#define SHAREDMEMORYRING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace NetworkTable {
+/*
+ * A ring buffer in POSIX shared memory which one process writes
+ * messages into, and any number of processes on the same host read
+ * every message from. Readers don't make a syscall per message:
+ * they only sleep (on a futex in the shared memory) when they have
+ * caught up with the writer.
+ *
+ * The writer never waits for readers. If a reader falls more than
+ * a whole buffer behind, it loses messages, and Read returns OVERRUN.
+ *
+ * Each message is a topic and a body, so readers can skip messages
+ * they don't care about without looking at the body.
+ */
+class SharedMemoryRing {
+ public:
+    enum ReadResult { MESSAGE, EMPTY, OVERRUN };
+
+    SharedMemoryRing();
+    ~SharedMemoryRing();
+
+    /*
+     * Creates (or recreates) the shared memory as the writer.
+     * @param name - shared memory object name, eg. "/sailbot_nt"
+     * @param capacity - size of the buffer in bytes.
+     * @throws - std::runtime_error if it can't be created.
+     */
+    void Create(const std::string &name, uint64_t capacity);
+
+    /*
+     * Opens shared memory created by another process, as a reader.
+     * Reading starts from the newest message.
+     * @throws - std::runtime_error if it can't be opened.
+     */
+    void Open(const std::string &name);
+
+    bool IsOpen() const;
+
+    /*
+     * Writes a message and wakes any sleeping readers.
+     * Returns false (and writes nothing) if the message
+     * is too big to fit in half of the buffer.
+     */
+    bool Write(const std::string &topic, const std::string &body);
+    bool Write(const std::string &topic, const void *body, uint64_t body_size);
+
+    /*
+     * Copies the next message into topic and body.
+     * Returns EMPTY if there are no new messages,
+     * or OVERRUN if messages were lost because the writer
+     * lapped us (reading continues from the newest message).
+     */
+    ReadResult Read(std::string *topic, std::string *body);
+
+    /*
+     * Sleeps until there is a message to read, or
+     * timeout_millis passes.
+     */
+    void Wait(int timeout_millis);
+
+ private:
+    // Lives at the start of the shared memory,
+    // followed by capacity bytes of messages.
+    struct Header {
+        std::atomic<uint64_t> reserved;   // End of the message being written.
+        std::atomic<uint64_t> committed;  // End of the last complete message.
+        std::atomic<uint32_t> futex;      // Incremented to wake readers.
+        std::atomic<uint32_t> waiters;    // Number of readers asleep.
+        uint64_t capacity;
+    };
+
+    /*
+     * Copies to/from the buffer at position,
+     * wrapping around the end of it.
+     */
+    void CopyIn(uint64_t position, const void *data, uint64_t size);
+    void CopyOut(uint64_t position, void *data, uint64_t size) const;
+
+    void Close();
+
+    std::string name_;
+    bool is_writer_;
+    Header *header_;
+    char *buffer_;
+    uint64_t mapped_size_;
+    uint64_t read_position_;  // Only used by readers.
+};
+}  // namespace NetworkTable
+
+#endif  // SHAREDMEMORYRING_H_
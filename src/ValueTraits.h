@@ -0,0 +1,113 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef VALUETRAITS_H_
+#define VALUETRAITS_H_
+
+#include "Value.pb.h"
+
+#include <string>
+
+namespace NetworkTable {
+/*
+ * How a C++ type is stored in a Value, so that Connection::Set
+ * and Connection::Get can pick the Value::Type at compile time.
+ * Only the types specialized below are supported; any other
+ * type doesn't compile.
+ *
+ * kType - the Value::Type it is stored as.
+ * ToValue - sets the type and data of value.
+ * FromValue - reads the data back out of value.
+ */
+template <typename T>
+struct ValueTraits;
+
+template <>
+struct ValueTraits<int> {
+    static const NetworkTable::Value::Type kType = NetworkTable::Value::INT;
+
+    static void ToValue(int data, NetworkTable::Value *value) {
+        value->set_type(kType);
+        value->set_int_data(data);
+    }
+
+    static int FromValue(const NetworkTable::Value &value) {
+        return value.int_data();
+    }
+};
+
+template <>
+struct ValueTraits<float> {
+    static const NetworkTable::Value::Type kType = NetworkTable::Value::FLOAT;
+
+    static void ToValue(float data, NetworkTable::Value *value) {
+        value->set_type(kType);
+        value->set_float_data(data);
+    }
+
+    static float FromValue(const NetworkTable::Value &value) {
+        return value.float_data();
+    }
+};
+
+// Values only have single precision,
+// so doubles are stored as floats.
+template <>
+struct ValueTraits<double> {
+    static const NetworkTable::Value::Type kType = NetworkTable::Value::FLOAT;
+
+    static void ToValue(double data, NetworkTable::Value *value) {
+        value->set_type(kType);
+        value->set_float_data(static_cast<float>(data));
+    }
+
+    static double FromValue(const NetworkTable::Value &value) {
+        return value.float_data();
+    }
+};
+
+template <>
+struct ValueTraits<bool> {
+    static const NetworkTable::Value::Type kType = NetworkTable::Value::BOOL;
+
+    static void ToValue(bool data, NetworkTable::Value *value) {
+        value->set_type(kType);
+        value->set_bool_data(data);
+    }
+
+    static bool FromValue(const NetworkTable::Value &value) {
+        return value.bool_data();
+    }
+};
+
+template <>
+struct ValueTraits<std::string> {
+    static const NetworkTable::Value::Type kType = NetworkTable::Value::STRING;
+
+    static void ToValue(const std::string &data, NetworkTable::Value *value) {
+        value->set_type(kType);
+        value->set_string_data(data);
+    }
+
+    static std::string FromValue(const NetworkTable::Value &value) {
+        return value.string_data();
+    }
+};
+
+// So that string literals can be set. There is no
+// FromValue, use std::string to get them back.
+template <>
+struct ValueTraits<const char*> {
+    static const NetworkTable::Value::Type kType = NetworkTable::Value::STRING;
+
+    static void ToValue(const char *data, NetworkTable::Value *value) {
+        value->set_type(kType);
+        value->set_string_data(data);
+    }
+};
+
+template <>
+struct ValueTraits<char*> : ValueTraits<const char*> {
+};
+}  // namespace NetworkTable
+
+#endif  // VALUETRAITS_H_
@@ -0,0 +1,89 @@
+// Copyright 2017 UBC Sailbot
+
+#include "CallbackExecutorTest.h"
+#include "CallbackExecutor.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_F(CallbackExecutorTest, InlineTest) {
+    NetworkTable::CallbackExecutor executor;
+    executor.Start(0);
+
+    // With no threads, the callback has already run.
+    std::thread::id ran_on;
+    executor.Run("gps_0", [&ran_on] {
+        ran_on = std::this_thread::get_id();
+    });
+    EXPECT_EQ(ran_on, std::this_thread::get_id());
+    EXPECT_EQ(executor.MaxQueueDepth(), 0u);
+}
+
+TEST_F(CallbackExecutorTest, OrderTest) {
+    NetworkTable::CallbackExecutor executor;
+    executor.Start(4);
+
+    // Callbacks for the same key run in order, even
+    // though the keys are spread over several threads.
+    const int kNumKeys = 8;
+    const int kNumCallbacks = 1000;
+    std::mutex mutex;
+    std::vector<std::vector<int>> ran(kNumKeys);
+    for (int i = 0; i < kNumCallbacks; i++) {
+        for (int key = 0; key < kNumKeys; key++) {
+            executor.Run(std::to_string(key), [&mutex, &ran, key, i] {
+                std::lock_guard<std::mutex> lock(mutex);
+                ran[key].push_back(i);
+            });
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (executor.QueueDepth() > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    executor.Stop();
+
+    for (int key = 0; key < kNumKeys; key++) {
+        ASSERT_EQ(ran[key].size(), static_cast<size_t>(kNumCallbacks));
+        for (int i = 0; i < kNumCallbacks; i++) {
+            EXPECT_EQ(ran[key][i], i);
+        }
+    }
+    EXPECT_GT(executor.MaxQueueDepth(), 0u);
+}
+
+TEST_F(CallbackExecutorTest, SlowCallbackTest) {
+    NetworkTable::CallbackExecutor executor;
+    executor.Start(1);
+
+    // Run doesn't wait for a slow callback,
+    // the later ones queue up behind it.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic_int num_ran(0);
+    auto start = std::chrono::steady_clock::now();
+    executor.Run("actuation_angle", [released, &num_ran] {
+        released.wait();
+        num_ran++;
+    });
+    executor.Run("actuation_angle", [&num_ran] {
+        num_ran++;
+    });
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    EXPECT_EQ(num_ran, 0);
+    EXPECT_GE(executor.QueueDepth(), 1u);
+
+    release.set_value();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (num_ran < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(num_ran, 2);
+    EXPECT_EQ(executor.QueueDepth(), 0u);
+}
@@ -0,0 +1,17 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef CALLBACKEXECUTORTEST_H_
+#define CALLBACKEXECUTORTEST_H_
+
+#include <gtest/gtest.h>
+
+class CallbackExecutorTest : public ::testing::Test {
+ protected:
+    void InlineTest();
+
+    void OrderTest();
+
+    void SlowCallbackTest();
+};
+
+#endif  // CALLBACKEXECUTORTEST_H_
@@ -0,0 +1,179 @@
+// Copyright 2017 UBC Sailbot
+
+#include "ConnectionTest.h"
+#include "Connection.h"
+#include "Exceptions.h"
+#include "Server.h"
+
+#include <boost/filesystem.hpp>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+void ConnectionTest::SetUp() {
+    char directory[] = "/tmp/connection_test_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+    directory_ = std::string(directory) + "/";
+    shared_memory_name_ = "/connection_test_" + std::to_string(getpid());
+    StartServer();
+}
+
+void ConnectionTest::TearDown() {
+    KillServer();
+    shm_unlink(shared_memory_name_.c_str());
+    boost::filesystem::remove_all(directory_);
+}
+
+void ConnectionTest::StartServer() {
+    server_pid_ = fork();
+    ASSERT_NE(server_pid_, -1);
+    if (server_pid_ == 0) {
+        try {
+            NetworkTable::Server server(directory_, shared_memory_name_);
+            server.Run();
+        } catch (...) {
+        }
+        _exit(0);
+    }
+}
+
+void ConnectionTest::KillServer() {
+    if (server_pid_ > 0) {
+        kill(server_pid_, SIGKILL);
+        waitpid(server_pid_, nullptr, 0);
+        server_pid_ = -1;
+    }
+}
+
+TEST_F(ConnectionTest, ModifyValueErrorTest) {
+    NetworkTable::Connection connection(directory_, shared_memory_name_);
+    connection.Connect(1000);
+
+    NetworkTable::Value name;
+    name.set_type(NetworkTable::Value::STRING);
+    name.set_string_data("ada");
+    connection.SetValue("connection_test/name", name);
+
+    // Incrementing a string is a bad request, not a missing node.
+    NetworkTable::Value one;
+    one.set_type(NetworkTable::Value::INT);
+    one.set_int_data(1);
+    bool threw_runtime_error = false;
+    try {
+        connection.Increment("connection_test/name", one);
+    } catch (const NetworkTable::NodeNotFoundException &e) {
+        FAIL() << "bad increment threw NodeNotFoundException: " << e.what();
+    } catch (const std::runtime_error &e) {
+        threw_runtime_error = true;
+    }
+    EXPECT_TRUE(threw_runtime_error);
+
+    // The value is left alone, and the connection still works.
+    EXPECT_EQ(connection.GetValue("connection_test/name").string_data(), "ada");
+    EXPECT_EQ(connection.Increment("connection_test/count_" + std::to_string(getpid()), one).int_data(), 1);
+
+    connection.Disconnect();
+}
+
+TEST_F(ConnectionTest, GetWrongTypeTest) {
+    NetworkTable::Connection connection(directory_, shared_memory_name_);
+    connection.Connect(1000);
+
+    connection.Set("connection_test/heading", 270);
+    EXPECT_EQ(connection.Get<int>("connection_test/heading"), 270);
+
+    // Asking for a different type than is stored throws,
+    // rather than reading the wrong field.
+    EXPECT_THROW(connection.Get<std::string>("connection_test/heading"), std::runtime_error);
+    EXPECT_THROW(connection.Get<float>("connection_test/heading"), std::runtime_error);
+
+    connection.Disconnect();
+}
+
+TEST_F(ConnectionTest, FanoutSubscribeTest) {
+    NetworkTable::Connection subscriber(directory_, shared_memory_name_);
+    subscriber.EnableFanout();
+    subscriber.Connect(1000);
+
+    NetworkTable::Connection writer(directory_, shared_memory_name_);
+    writer.Connect(1000);
+
+    // Once Subscribe returns, the server's fan-out socket
+    // must already know about us, so the very next
+    // update can't be lost.
+    std::atomic_int updates(0);
+    subscriber.Subscribe("connection_test/fanout", [&updates](NetworkTable::Node, \
+            const std::map<std::string, NetworkTable::Value> &, bool) {
+        updates++;
+    });
+
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::INT);
+    value.set_int_data(1);
+    writer.SetValue("connection_test/fanout", value);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (updates == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(updates, 1);
+
+    writer.Disconnect();
+    subscriber.Disconnect();
+}
+
+TEST_F(ConnectionTest, ReconnectAfterRestartTest) {
+    // One subscriber of each socket type, so a single
+    // restart covers both reconnect paths.
+    NetworkTable::Connection pair_subscriber(directory_, shared_memory_name_);
+    NetworkTable::Connection router_subscriber(directory_, shared_memory_name_);
+    router_subscriber.EnableRouter();
+
+    std::atomic_int pair_updates(0);
+    std::atomic_int router_updates(0);
+    for (auto subscriber : {std::make_pair(&pair_subscriber, &pair_updates), \
+            std::make_pair(&router_subscriber, &router_updates)}) {
+        std::atomic_int *updates = subscriber.second;
+        subscriber.first->EnableReconnect();
+        subscriber.first->Connect(1000);
+        subscriber.first->Subscribe("connection_test/restart", [updates](NetworkTable::Node, \
+                const std::map<std::string, NetworkTable::Value> &, bool) {
+            (*updates)++;
+        });
+    }
+
+    // Stay down long enough for the subscribers to give up
+    // on the old session and start reconnecting.
+    KillServer();
+    std::this_thread::sleep_for(std::chrono::seconds(4));
+    StartServer();
+
+    // The subscribers have to notice the restart and subscribe
+    // again, so keep writing until an update gets through to both.
+    NetworkTable::Connection writer(directory_, shared_memory_name_);
+    writer.Connect(1000);
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::INT);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    for (int i = 0; (pair_updates == 0 || router_updates == 0) \
+            && std::chrono::steady_clock::now() < deadline; i++) {
+        value.set_int_data(i);
+        writer.SetValue("connection_test/restart", value);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_GT(pair_updates, 0);
+    EXPECT_GT(router_updates, 0);
+
+    writer.Disconnect();
+    pair_subscriber.Disconnect();
+    router_subscriber.Disconnect();
+}
@@ -0,0 +1,47 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef CONNECTIONTEST_H_
+#define CONNECTIONTEST_H_
+
+#include <gtest/gtest.h>
+#include <sys/types.h>
+#include <string>
+
+/*
+ * Runs a network table server in a child process,
+ * so that the client can be tested against it.
+ * The server gets its own temporary directory and
+ * shared memory, so it doesn't touch a real server
+ * running on the same machine.
+ */
+class ConnectionTest : public ::testing::Test {
+ protected:
+    void SetUp() override;
+
+    void TearDown() override;
+
+    /*
+     * Forks a new server process.
+     */
+    void StartServer();
+
+    /*
+     * Kills the server process without letting
+     * it clean up, like a crash would.
+     */
+    void KillServer();
+
+    void ModifyValueErrorTest();
+
+    void GetWrongTypeTest();
+
+    void FanoutSubscribeTest();
+
+    void ReconnectAfterRestartTest();
+
+    pid_t server_pid_ = -1;
+    std::string directory_;  // Where the server's sockets and saved tables go.
+    std::string shared_memory_name_;
+};
+
+#endif  // CONNECTIONTEST_H_
@@ -0,0 +1,93 @@
+// Copyright 2017 UBC Sailbot
+
+#include "DerivedValuesTest.h"
+#include "DerivedValues.h"
+#include "Help.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+const double precision = 0.001;
+
+NetworkTable::Value IntValue(int data) {
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::INT);
+    value.set_int_data(data);
+    return value;
+}
+
+TEST_F(DerivedValuesTest, AggregateTest) {
+    NetworkTable::DerivedValues derived_values;
+    derived_values.Load({
+        "# comments and blank lines are ignored",
+        "",
+        "wind/average_speed = avg(wind_sensor_{0..2}/iimwv/wind_speed)",
+        "/wind/max_speed = max(wind_sensor_{0..2}/iimwv/wind_speed)",
+    });
+
+    NetworkTable::Node root;
+    NetworkTable::SetNode("wind_sensor_0/iimwv/wind_speed", IntValue(4), &root);
+    NetworkTable::SetNode("wind_sensor_1/iimwv/wind_speed", IntValue(8), &root);
+
+    // Only inputs which exist are used.
+    auto derived = derived_values.Update({"/wind_sensor_0/iimwv/wind_speed", \
+            "wind_sensor_1/iimwv/wind_speed"}, &root);
+    EXPECT_NEAR(derived.at("wind/average_speed").float_data(), 6, precision);
+    EXPECT_EQ(derived.at("wind/max_speed").int_data(), 8);
+
+    // Changing an unrelated uri doesn't recompute anything.
+    NetworkTable::SetNode("gps_0/gprmc/latitude", IntValue(1), &root);
+    EXPECT_TRUE(derived_values.Update({"gps_0/gprmc/latitude"}, &root).empty());
+
+    // Values which didn't change are not published again.
+    NetworkTable::SetNode("wind_sensor_2/iimwv/wind_speed", IntValue(6), &root);
+    derived = derived_values.Update({"wind_sensor_2/iimwv/wind_speed"}, &root);
+    EXPECT_EQ(derived.size(), 0u);
+}
+
+TEST_F(DerivedValuesTest, ChainedTest) {
+    NetworkTable::DerivedValues derived_values;
+    // Declared out of order on purpose.
+    derived_values.Load({
+        "bms/total = sum(bms/pack_{0..1})",
+        "bms/pack_0 = sum(bms_{0..2}/uccm/current)",
+        "bms/pack_1 = sum(bms_{3..5}/uccm/current)",
+    });
+
+    NetworkTable::Node root;
+    std::set<std::string> uris;
+    for (int i = 0; i < 6; i++) {
+        std::string uri = "bms_" + std::to_string(i) + "/uccm/current";
+        NetworkTable::SetNode(uri, IntValue(i), &root);
+        uris.insert(uri);
+    }
+
+    auto derived = derived_values.Update(uris, &root);
+    EXPECT_EQ(derived.at("bms/pack_0").int_data(), 3);
+    EXPECT_EQ(derived.at("bms/pack_1").int_data(), 12);
+    EXPECT_EQ(derived.at("bms/total").int_data(), 15);
+}
+
+TEST_F(DerivedValuesTest, StaleTest) {
+    NetworkTable::DerivedValues derived_values;
+    derived_values.Load({"gps_0/is_stale = stale(gps_0/gprmc/latitude, 20)"});
+    EXPECT_EQ(derived_values.MillisUntilExpiry(), -1);
+
+    NetworkTable::Node root;
+    NetworkTable::SetNode("gps_0/gprmc/latitude", IntValue(1), &root);
+    auto derived = derived_values.Update({"gps_0/gprmc/latitude"}, &root);
+    EXPECT_FALSE(derived.at("gps_0/is_stale").bool_data());
+    EXPECT_GE(derived_values.MillisUntilExpiry(), 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    derived = derived_values.Expire(&root);
+    EXPECT_TRUE(derived.at("gps_0/is_stale").bool_data());
+    EXPECT_EQ(derived_values.MillisUntilExpiry(), -1);
+}
+
+TEST_F(DerivedValuesTest, CycleTest) {
+    NetworkTable::DerivedValues derived_values;
+    EXPECT_THROW(derived_values.Load({"a = sum(b)", "b = sum(a)"}), std::runtime_error);
+    EXPECT_THROW(derived_values.Load({"a = median(b)"}), std::runtime_error);
+}
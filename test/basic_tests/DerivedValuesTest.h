@@ -0,0 +1,19 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef DERIVEDVALUESTEST_H_
+#define DERIVEDVALUESTEST_H_
+
+#include <gtest/gtest.h>
+
+class DerivedValuesTest : public ::testing::Test {
+ protected:
+    void AggregateTest();
+
+    void ChainedTest();
+
+    void StaleTest();
+
+    void CycleTest();
+};
+
+#endif  // DERIVEDVALUESTEST_H_
@@ -2,6 +2,7 @@
 
 #include "HelpTest.h"
 #include "Help.h"
+#include "Exceptions.h"
 
 const double precision = 0.001;
 
@@ -54,3 +55,113 @@ TEST_F(HelpTest, WriteLoadTest) {
     EXPECT_NEAR(NetworkTable::GetNode("gps/lat", &new_root).value().float_data(), \
               gps_lat.float_data(), precision);
 }
+
+TEST_F(HelpTest, GetProjectedNodeTest) {
+    NetworkTable::Node root;
+
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::INT);
+    value.set_int_data(5);
+    NetworkTable::SetNode("/gps_0/gprmc/latitude", value, &root);
+    NetworkTable::SetNode("/gps_0/gprmc/longitude", value, &root);
+    NetworkTable::SetNode("/gps_0/gpgga/hdop", value, &root);
+    NetworkTable::SetNode("/wind_sensor_0/iimwv/wind_speed", value, &root);
+
+    // Only the requested fields should be in the projected node.
+    NetworkTable::Node node = NetworkTable::GetProjectedNode("/gps_0", \
+            {"gprmc/latitude", "gpgga"}, &root);
+    EXPECT_EQ(node.children().at("gprmc").children().at("latitude").value().int_data(), \
+              value.int_data());
+    EXPECT_EQ(node.children().at("gprmc").children().count("longitude"), 0);
+    EXPECT_EQ(node.children().at("gpgga").children().at("hdop").value().int_data(), \
+              value.int_data());
+
+    // Fields which don't exist are left out.
+    NetworkTable::Node root_node = NetworkTable::GetProjectedNode("/", \
+            {"wind_sensor_0", "wind_sensor_1"}, &root);
+    EXPECT_EQ(root_node.children().size(), 1);
+    EXPECT_EQ(root_node.children().count("wind_sensor_0"), 1);
+
+    // The uri itself must still exist.
+    EXPECT_THROW(NetworkTable::GetProjectedNode("/gps_1", {"gprmc"}, &root), \
+                 NetworkTable::NodeNotFoundException);
+}
+
+TEST_F(HelpTest, GetValueTest) {
+    NetworkTable::Node root;
+
+    NetworkTable::Value value;
+    value.set_type(NetworkTable::Value::FLOAT);
+    value.set_float_data(49.5);
+    NetworkTable::SetNode("/gps_0/gprmc/latitude", value, &root);
+
+    EXPECT_EQ(NetworkTable::GetValue("gps_0/gprmc/latitude", &root).float_data(), value.float_data());
+    EXPECT_THROW(NetworkTable::GetValue("/gps_0/gprmc/longitude", &root), \
+                 NetworkTable::NodeNotFoundException);
+}
+
+TEST_F(HelpTest, IsDescendantTest) {
+    EXPECT_TRUE(NetworkTable::IsDescendant("/gps_0/gprmc/latitude", "gps_0"));
+    EXPECT_TRUE(NetworkTable::IsDescendant("gps_0/gprmc", "/gps_0/gprmc/"));
+    EXPECT_TRUE(NetworkTable::IsDescendant("gps_0", "/"));
+    EXPECT_FALSE(NetworkTable::IsDescendant("gps_0", "gps_0/gprmc"));
+    EXPECT_FALSE(NetworkTable::IsDescendant("gps_01/gprmc", "gps_0"));
+}
+
+TEST_F(HelpTest, RelativeUriTest) {
+    EXPECT_EQ("gprmc/latitude", NetworkTable::RelativeUri("/gps_0/gprmc/latitude", "gps_0"));
+    EXPECT_EQ("gps_0/gprmc", NetworkTable::RelativeUri("gps_0/gprmc/", "/"));
+    EXPECT_EQ("", NetworkTable::RelativeUri("/gps_0/gprmc", "gps_0/gprmc/"));
+}
+
+TEST_F(HelpTest, ModifyValueTest) {
+    NetworkTable::Value five;
+    five.set_type(NetworkTable::Value::INT);
+    five.set_int_data(5);
+    NetworkTable::Value six;
+    six.set_type(NetworkTable::Value::INT);
+    six.set_int_data(6);
+    NetworkTable::Value result;
+
+    // Compare and set only succeeds if the value matches,
+    // or if it should be missing and is.
+    NetworkTable::ModifyValueRequest compare_and_set;
+    compare_and_set.set_operation(NetworkTable::ModifyValueRequest::COMPARE_AND_SET);
+    compare_and_set.set_uri("counter");
+    *compare_and_set.mutable_value() = six;
+    EXPECT_TRUE(NetworkTable::ModifyValue(compare_and_set, nullptr, &result));
+    EXPECT_EQ(result.int_data(), 6);
+    EXPECT_FALSE(NetworkTable::ModifyValue(compare_and_set, &five, &result));
+    *compare_and_set.mutable_expected() = five;
+    EXPECT_TRUE(NetworkTable::ModifyValue(compare_and_set, &five, &result));
+    EXPECT_EQ(result.int_data(), 6);
+    EXPECT_FALSE(NetworkTable::ModifyValue(compare_and_set, &six, &result));
+    EXPECT_EQ(result.int_data(), 6);
+
+    NetworkTable::ModifyValueRequest increment;
+    increment.set_operation(NetworkTable::ModifyValueRequest::INCREMENT);
+    increment.set_uri("counter");
+    *increment.mutable_value() = five;
+    EXPECT_TRUE(NetworkTable::ModifyValue(increment, &six, &result));
+    EXPECT_EQ(result.int_data(), 11);
+
+    NetworkTable::Value text;
+    text.set_type(NetworkTable::Value::STRING);
+    text.set_string_data("abc");
+    EXPECT_THROW(NetworkTable::ModifyValue(increment, &text, &result), std::runtime_error);
+
+    // Appending waypoints keeps the old ones first.
+    NetworkTable::Value waypoints;
+    waypoints.set_type(NetworkTable::Value::WAYPOINTS);
+    waypoints.add_waypoints()->set_latitude(1);
+    NetworkTable::ModifyValueRequest append;
+    append.set_operation(NetworkTable::ModifyValueRequest::APPEND);
+    append.set_uri("waypoints");
+    append.mutable_value()->set_type(NetworkTable::Value::WAYPOINTS);
+    append.mutable_value()->add_waypoints()->set_latitude(2);
+    EXPECT_TRUE(NetworkTable::ModifyValue(append, &waypoints, &result));
+    ASSERT_EQ(result.waypoints_size(), 2);
+    EXPECT_EQ(result.waypoints(0).latitude(), 1);
+    EXPECT_EQ(result.waypoints(1).latitude(), 2);
+    EXPECT_THROW(NetworkTable::ModifyValue(append, &text, &result), std::runtime_error);
+}
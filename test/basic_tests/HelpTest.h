@@ -10,6 +10,16 @@ class HelpTest : public ::testing::Test {
     void GetSetTest();
 
     void WriteLoadTest();
+
+    void GetProjectedNodeTest();
+
+    void GetValueTest();
+
+    void IsDescendantTest();
+
+    void RelativeUriTest();
+
+    void ModifyValueTest();
 };
 
 #endif  // HELPTEST_H_
@@ -0,0 +1,68 @@
+// Copyright 2017 UBC Sailbot
+
+#include "LatencyHistogramTest.h"
+#include "LatencyHistogram.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST_F(LatencyHistogramTest, BucketTest) {
+    NetworkTable::LatencyHistogram histogram;
+    histogram.Record(std::chrono::nanoseconds(500));
+    histogram.Record(std::chrono::microseconds(1));
+    histogram.Record(std::chrono::microseconds(3));
+    histogram.Record(std::chrono::microseconds(1000));
+    histogram.Record(std::chrono::hours(24));
+
+    NetworkTable::LatencyStats stats = histogram.Read();
+    ASSERT_EQ(stats.buckets.size(), static_cast<size_t>(NetworkTable::LatencyHistogram::kNumBuckets));
+    EXPECT_EQ(stats.count, 5u);
+    EXPECT_EQ(stats.buckets[0], 1u);
+    EXPECT_EQ(stats.buckets[1], 1u);
+    EXPECT_EQ(stats.buckets[2], 1u);
+    EXPECT_EQ(stats.buckets[10], 1u);  // 512 up to 1024 us.
+    EXPECT_EQ(stats.buckets.back(), 1u);  // Longer than the last bucket.
+    EXPECT_DOUBLE_EQ(stats.max_micros, 24 * 3600 * 1e6);
+
+    histogram.Reset();
+    stats = histogram.Read();
+    EXPECT_EQ(stats.count, 0u);
+    EXPECT_EQ(stats.max_micros, 0);
+    EXPECT_EQ(stats.PercentileMicros(0.99), 0);
+}
+
+TEST_F(LatencyHistogramTest, PercentileTest) {
+    NetworkTable::LatencyHistogram histogram;
+    for (int i = 0; i < 99; i++) {
+        histogram.Record(std::chrono::microseconds(100));
+    }
+    histogram.Record(std::chrono::microseconds(5000));
+
+    NetworkTable::LatencyStats stats = histogram.Read();
+    EXPECT_DOUBLE_EQ(stats.mean_micros, 149);
+    EXPECT_DOUBLE_EQ(stats.PercentileMicros(0.5), 128);
+    EXPECT_DOUBLE_EQ(stats.PercentileMicros(0.99), 128);
+    EXPECT_DOUBLE_EQ(stats.PercentileMicros(1), 8192);
+}
+
+TEST_F(LatencyHistogramTest, ThreadsTest) {
+    NetworkTable::LatencyHistogram histogram;
+    const int kNumThreads = 4;
+    const int kNumRecords = 10000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; i++) {
+        threads.emplace_back([&histogram, i] {
+            for (int j = 0; j < kNumRecords; j++) {
+                histogram.Record(std::chrono::microseconds(i + 1));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    NetworkTable::LatencyStats stats = histogram.Read();
+    EXPECT_EQ(stats.count, static_cast<uint64_t>(kNumThreads * kNumRecords));
+    EXPECT_DOUBLE_EQ(stats.max_micros, kNumThreads);
+}
@@ -0,0 +1,17 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef LATENCYHISTOGRAMTEST_H_
+#define LATENCYHISTOGRAMTEST_H_
+
+#include <gtest/gtest.h>
+
+class LatencyHistogramTest : public ::testing::Test {
+ protected:
+    void BucketTest();
+
+    void PercentileTest();
+
+    void ThreadsTest();
+};
+
+#endif  // LATENCYHISTOGRAMTEST_H_
@@ -0,0 +1,90 @@
+// Copyright 2017 UBC Sailbot
+
+#include "RequestQueueTest.h"
+#include "RequestQueue.h"
+
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Helper function
+// Returns true if fd becomes readable within timeout_millis.
+bool IsReadable(int fd, int timeout_millis) {
+    struct pollfd pollfd = {fd, POLLIN, 0};
+    return poll(&pollfd, 1, timeout_millis) == 1;
+}
+
+TEST_F(RequestQueueTest, PushPopTest) {
+    NetworkTable::RequestQueue<std::string> queue;
+    std::vector<std::string> items;
+    queue.PopAll(&items);
+    EXPECT_TRUE(items.empty());
+
+    queue.Push("first");
+    queue.Push("second");
+    queue.Push("third");
+    EXPECT_EQ(queue.Size(), 3u);
+
+    // Items come out in the order they were pushed.
+    queue.PopAll(&items);
+    EXPECT_EQ(items, std::vector<std::string>({"first", "second", "third"}));
+    EXPECT_EQ(queue.Size(), 0u);
+
+    // And are added after anything already in items.
+    queue.Push("fourth");
+    queue.PopAll(&items);
+    EXPECT_EQ(items.back(), "fourth");
+    EXPECT_EQ(items.size(), 4u);
+}
+
+TEST_F(RequestQueueTest, WakeUpTest) {
+    NetworkTable::RequestQueue<int> queue;
+    EXPECT_FALSE(IsReadable(queue.fd(), 0));
+
+    std::thread pusher([&queue]() {
+        queue.Push(1);
+    });
+    EXPECT_TRUE(IsReadable(queue.fd(), 5000));
+    pusher.join();
+
+    std::vector<int> items;
+    queue.PopAll(&items);
+    EXPECT_EQ(items.size(), 1u);
+    EXPECT_FALSE(IsReadable(queue.fd(), 0));
+}
+
+TEST_F(RequestQueueTest, ManyPushersTest) {
+    const int kNumPushers = 4;
+    const int kNumItems = 10000;
+    NetworkTable::RequestQueue<std::pair<int, int>> queue;
+
+    std::vector<std::thread> pushers;
+    for (int pusher = 0; pusher < kNumPushers; pusher++) {
+        pushers.emplace_back([&queue, pusher]() {
+            for (int i = 0; i < kNumItems; i++) {
+                queue.Push({pusher, i});
+            }
+        });
+    }
+
+    // Pop while the pushers are still going. Each
+    // pusher's items must come out in order.
+    std::vector<int> next_item(kNumPushers, 0);
+    std::vector<std::pair<int, int>> items;
+    int num_popped = 0;
+    while (num_popped < kNumPushers * kNumItems && IsReadable(queue.fd(), 5000)) {
+        items.clear();
+        queue.PopAll(&items);
+        for (const auto &item : items) {
+            EXPECT_EQ(item.second, next_item[item.first]);
+            next_item[item.first] = item.second + 1;
+        }
+        num_popped += items.size();
+    }
+    for (auto &pusher : pushers) {
+        pusher.join();
+    }
+
+    EXPECT_EQ(num_popped, kNumPushers * kNumItems);
+}
@@ -0,0 +1,17 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef REQUESTQUEUETEST_H_
+#define REQUESTQUEUETEST_H_
+
+#include <gtest/gtest.h>
+
+class RequestQueueTest : public ::testing::Test {
+ protected:
+    void PushPopTest();
+
+    void WakeUpTest();
+
+    void ManyPushersTest();
+};
+
+#endif  // REQUESTQUEUETEST_H_
@@ -0,0 +1,104 @@
+// Copyright 2017 UBC Sailbot
+
+#include "SharedMemoryRingTest.h"
+#include "SharedMemoryRing.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+const char kRingName[] = "/sailbot_nt_ring_test";
+
+TEST_F(SharedMemoryRingTest, WriteReadTest) {
+    NetworkTable::SharedMemoryRing writer;
+    writer.Create(kRingName, 1024);
+
+    NetworkTable::SharedMemoryRing reader_0;
+    NetworkTable::SharedMemoryRing reader_1;
+    reader_0.Open(kRingName);
+    reader_1.Open(kRingName);
+
+    std::string topic;
+    std::string body;
+    EXPECT_EQ(reader_0.Read(&topic, &body), NetworkTable::SharedMemoryRing::EMPTY);
+
+    EXPECT_TRUE(writer.Write("gps_0", "first"));
+    EXPECT_TRUE(writer.Write("/", std::string("with\0null", 9)));
+
+    // Every reader gets every message.
+    for (auto *reader : {&reader_0, &reader_1}) {
+        EXPECT_EQ(reader->Read(&topic, &body), NetworkTable::SharedMemoryRing::MESSAGE);
+        EXPECT_EQ(topic, "gps_0");
+        EXPECT_EQ(body, "first");
+        EXPECT_EQ(reader->Read(&topic, &body), NetworkTable::SharedMemoryRing::MESSAGE);
+        EXPECT_EQ(topic, "/");
+        EXPECT_EQ(body, std::string("with\0null", 9));
+        EXPECT_EQ(reader->Read(&topic, &body), NetworkTable::SharedMemoryRing::EMPTY);
+    }
+
+    // Messages bigger than half the buffer are refused.
+    EXPECT_FALSE(writer.Write("/", std::string(600, 'x')));
+}
+
+TEST_F(SharedMemoryRingTest, WrapAroundTest) {
+    NetworkTable::SharedMemoryRing writer;
+    writer.Create(kRingName, 256);
+    NetworkTable::SharedMemoryRing reader;
+    reader.Open(kRingName);
+
+    std::string topic;
+    std::string body;
+    for (int i = 0; i < 100; i++) {
+        std::string expected_body(i % 50, static_cast<char>('a' + i % 26));
+        EXPECT_TRUE(writer.Write(std::to_string(i), expected_body));
+        EXPECT_EQ(reader.Read(&topic, &body), NetworkTable::SharedMemoryRing::MESSAGE);
+        EXPECT_EQ(topic, std::to_string(i));
+        EXPECT_EQ(body, expected_body);
+    }
+}
+
+TEST_F(SharedMemoryRingTest, OverrunTest) {
+    NetworkTable::SharedMemoryRing writer;
+    writer.Create(kRingName, 256);
+    NetworkTable::SharedMemoryRing reader;
+    reader.Open(kRingName);
+
+    // Lap the reader.
+    for (int i = 0; i < 20; i++) {
+        writer.Write("topic", std::string(40, 'x'));
+    }
+
+    std::string topic;
+    std::string body;
+    EXPECT_EQ(reader.Read(&topic, &body), NetworkTable::SharedMemoryRing::OVERRUN);
+    EXPECT_EQ(reader.Read(&topic, &body), NetworkTable::SharedMemoryRing::EMPTY);
+
+    // It keeps working after catching up.
+    writer.Write("topic", "body");
+    EXPECT_EQ(reader.Read(&topic, &body), NetworkTable::SharedMemoryRing::MESSAGE);
+    EXPECT_EQ(body, "body");
+}
+
+TEST_F(SharedMemoryRingTest, WaitTest) {
+    NetworkTable::SharedMemoryRing writer;
+    writer.Create(kRingName, 1024);
+    NetworkTable::SharedMemoryRing reader;
+    reader.Open(kRingName);
+
+    std::thread writer_thread([&writer]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        writer.Write("topic", "body");
+    });
+
+    // Should wake up as soon as the message is written,
+    // long before the timeout.
+    auto start = std::chrono::steady_clock::now();
+    reader.Wait(5000);
+    auto waited = std::chrono::steady_clock::now() - start;
+    writer_thread.join();
+
+    EXPECT_LT(waited, std::chrono::seconds(2));
+    std::string topic;
+    std::string body;
+    EXPECT_EQ(reader.Read(&topic, &body), NetworkTable::SharedMemoryRing::MESSAGE);
+}
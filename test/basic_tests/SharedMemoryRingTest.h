@@ -0,0 +1,19 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef SHAREDMEMORYRINGTEST_H_
+#define SHAREDMEMORYRINGTEST_H_
+
+#include <gtest/gtest.h>
+
+class SharedMemoryRingTest : public ::testing::Test {
+ protected:
+    void WriteReadTest();
+
+    void WrapAroundTest();
+
+    void OverrunTest();
+
+    void WaitTest();
+};
+
+#endif  // SHAREDMEMORYRINGTEST_H_
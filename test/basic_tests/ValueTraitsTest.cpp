@@ -0,0 +1,34 @@
+// Copyright 2017 UBC Sailbot
+
+#include "ValueTraitsTest.h"
+#include "ValueTraits.h"
+
+#include <string>
+
+TEST_F(ValueTraitsTest, RoundTripTest) {
+    NetworkTable::Value value;
+
+    NetworkTable::ValueTraits<int>::ToValue(-3, &value);
+    EXPECT_EQ(value.type(), NetworkTable::Value::INT);
+    EXPECT_EQ(NetworkTable::ValueTraits<int>::FromValue(value), -3);
+
+    NetworkTable::ValueTraits<float>::ToValue(-0.5f, &value);
+    EXPECT_EQ(value.type(), NetworkTable::Value::FLOAT);
+    EXPECT_EQ(NetworkTable::ValueTraits<float>::FromValue(value), -0.5f);
+
+    NetworkTable::ValueTraits<double>::ToValue(49.25, &value);
+    EXPECT_EQ(value.type(), NetworkTable::Value::FLOAT);
+    EXPECT_EQ(NetworkTable::ValueTraits<double>::FromValue(value), 49.25);
+
+    NetworkTable::ValueTraits<bool>::ToValue(true, &value);
+    EXPECT_EQ(value.type(), NetworkTable::Value::BOOL);
+    EXPECT_TRUE(NetworkTable::ValueTraits<bool>::FromValue(value));
+
+    NetworkTable::ValueTraits<std::string>::ToValue(std::string("gprmc"), &value);
+    EXPECT_EQ(value.type(), NetworkTable::Value::STRING);
+    EXPECT_EQ(NetworkTable::ValueTraits<std::string>::FromValue(value), "gprmc");
+
+    NetworkTable::ValueTraits<const char*>::ToValue("gpgga", &value);
+    EXPECT_EQ(value.type(), NetworkTable::Value::STRING);
+    EXPECT_EQ(NetworkTable::ValueTraits<std::string>::FromValue(value), "gpgga");
+}
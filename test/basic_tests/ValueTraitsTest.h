@@ -0,0 +1,13 @@
+// Copyright 2017 UBC Sailbot
+
+#ifndef VALUETRAITSTEST_H_
+#define VALUETRAITSTEST_H_
+
+#include <gtest/gtest.h>
+
+class ValueTraitsTest : public ::testing::Test {
+ protected:
+    void RoundTripTest();
+};
+
+#endif  // VALUETRAITSTEST_H_